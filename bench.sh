@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# builds and runs the benchmarks in bench/, results are written as JSON.
+# usage: ./bench.sh [suite] [-- benchmark args]
+# the check suite runs first and stops the script if the VM's output for
+# bench/check.wren differs from bench/check.expected
+
+cflags="-Wall -O3 -g -std=gnu11 -fno-strict-aliasing -Isrc"
+lflags="-lSDL2 -lm -lpthread"
+[[ $(uname) == Linux ]] && lflags="$lflags -lrt"
+compiler="gcc"
+
+if command -v ccache >/dev/null; then
+  compiler="ccache $compiler"
+fi
+
+suites="check renderer vm"
+if [[ $1 != "" && $1 != "--" ]]; then
+  suites="$1"
+  shift
+fi
+[[ $1 == "--" ]] && shift
+
+for suite in $suites; do
+  case $suite in
+    check) srcs="bench/check.c $(find src -name "*.c" ! -name main.c)" ;;
+    renderer) srcs="bench/renderer.c src/lib/stb/stb_truetype.c" ;;
+    vm) srcs="bench/vm.c $(find src -name "*.c" ! -name main.c)" ;;
+    *) echo "unknown benchmark suite: $suite" >&2; exit 1 ;;
+  esac
+
+  echo "compiling bench_$suite..." >&2
+  $compiler $cflags $srcs $lflags -o "bench_$suite" || exit 1
+  if [[ $suite == check ]]; then
+    diff -u bench/check.expected <(./bench_check) >&2 || checks_failed=true
+  else
+    ./bench_$suite "$@"
+  fi
+  rm "bench_$suite"
+
+  if [[ $checks_failed ]]; then
+    echo "checks failed" >&2
+    exit 1
+  fi
+done
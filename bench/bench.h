@@ -0,0 +1,76 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+/* tiny benchmark harness shared by the programs in this directory. Each
+** benchmark is run with a doubling iteration count until it has taken at least
+** `bench_min_time` seconds; results are written to stdout as a JSON array */
+
+typedef struct {
+  const char *name;
+  void (*setup)(void);
+  void (*run)(int iterations);
+  double pixels;  /* pixels touched per op, 0 if not meaningful */
+  const char *arg;
+} Bench;
+
+static double bench_min_time = 0.5;
+static const char *bench_filter;
+static Bench *bench_current;
+
+
+static double bench_now(void) {
+  return (double) SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+}
+
+
+static void bench_parse_args(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+      bench_min_time = atof(argv[++i]);
+    } else {
+      bench_filter = argv[i];
+    }
+  }
+}
+
+
+static void bench_run_all(const char *suite, Bench *benches, int count) {
+  printf("{\n  \"suite\": \"%s\",\n  \"results\": [", suite);
+  int printed = 0;
+  for (int i = 0; i < count; i++) {
+    Bench *b = &benches[i];
+    if (bench_filter && !strstr(b->name, bench_filter)) { continue; }
+    bench_current = b;
+    if (b->setup) { b->setup(); }
+
+    /* warm up, then grow the iteration count until the run is long enough */
+    b->run(1);
+    int iterations = 1;
+    double elapsed;
+    for (;;) {
+      double start = bench_now();
+      b->run(iterations);
+      elapsed = bench_now() - start;
+      if (elapsed >= bench_min_time || iterations >= (1 << 30)) { break; }
+      iterations *= 2;
+    }
+
+    double ns_per_op = elapsed * 1e9 / iterations;
+    printf("%s\n    { \"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.2f, \"pixels_per_sec\": ",
+      printed++ ? "," : "", b->name, iterations, ns_per_op);
+    if (b->pixels > 0) {
+      printf("%.0f }", b->pixels * iterations / elapsed);
+    } else {
+      printf("null }");
+    }
+    fflush(stdout);
+  }
+  printf("\n  ]\n}\n");
+}
+
+#endif
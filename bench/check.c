@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* main.c is compiled into this file so the checks run on a VM created with
+** exactly the configuration used by the editor */
+#define main lite_main
+#include "../src/main.c"
+#undef main
+
+
+static char* read_file(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) { return NULL; }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+  char *buf = malloc(size + 1);
+  if (fread(buf, 1, size, fp) != (size_t) size) {
+    free(buf);
+    fclose(fp);
+    return NULL;
+  }
+  buf[size] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+
+/* runs bench/check.wren, which prints its results for bench.sh to compare with
+** bench/check.expected */
+int main(int argc, char **argv) {
+  char *source = read_file("bench/check.wren");
+  if (!source) {
+    fprintf(stderr, "Error: could not read bench/check.wren, run from the repository root\n");
+    return EXIT_FAILURE;
+  }
+
+  WrenConfiguration config;
+  init_config(&config);
+  WrenVM *vm = wrenNewVM(&config);
+  WrenInterpretResult result = wrenInterpret(vm, "check", source);
+  wrenFreeVM(vm);
+  free(source);
+  return result == WREN_RESULT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,199 @@
+#include <string.h>
+#include "bench.h"
+
+/* the renderer and rencache are compiled into this file directly so the static
+** parts (glyphset baking, the rect merging pass) can be measured in isolation */
+#include "../src/renderer.c"
+#include "../src/rencache.c"
+
+#define SCREEN_W 1280
+#define SCREEN_H 800
+
+static RenFont *font;
+static RenFont *mono;
+static int line_height;
+static volatile int sink;
+
+static const char *ascii_text =
+  "  for (int i = 0; i < count; i++) { total += values[i] * 2; }";
+static const char *utf8_text =
+  "  λ → ∑ résumé naïve façade — Ελληνικά Кириллица ひらがな 漢字 ✓";
+
+
+static void bench_draw_rect_opaque(int n) {
+  RenRect r = { 0, 0, 400, 300 };
+  for (int i = 0; i < n; i++) {
+    ren_draw_rect(r, (RenColor) { 40, 40, i, 255 });
+  }
+}
+
+
+static void bench_draw_rect_blended(int n) {
+  RenRect r = { 0, 0, 400, 300 };
+  for (int i = 0; i < n; i++) {
+    ren_draw_rect(r, (RenColor) { 40, 40, i, 128 });
+  }
+}
+
+
+static void bench_draw_text_ascii(int n) {
+  RenColor c = { 200, 200, 200, 255 };
+  for (int i = 0; i < n; i++) {
+    sink = ren_draw_text(mono, ascii_text, 10, 10, c);
+  }
+}
+
+
+static void bench_draw_text_utf8(int n) {
+  RenColor c = { 200, 200, 200, 255 };
+  for (int i = 0; i < n; i++) {
+    sink = ren_draw_text(font, utf8_text, 10, 10, c);
+  }
+}
+
+
+static void bench_font_width_ascii(int n) {
+  for (int i = 0; i < n; i++) {
+    sink = ren_get_font_width(mono, ascii_text);
+  }
+}
+
+
+static void bench_font_width_utf8(int n) {
+  for (int i = 0; i < n; i++) {
+    sink = ren_get_font_width(font, utf8_text);
+  }
+}
+
+
+static void bench_glyphset_bake(int n) {
+  for (int i = 0; i < n; i++) {
+    GlyphSet *set = load_glyphset(mono, 0);
+    ren_free_image(set->image);
+    free(set);
+  }
+}
+
+
+/* draws a frame resembling a docview: background, gutter, lines of code and an
+** optional caret. `scroll` offsets the text by whole lines */
+static void draw_editor_frame(int scroll, bool caret) {
+  RenColor bg = { 46, 40, 39, 255 };
+  RenColor gutter = { 56, 50, 49, 255 };
+  RenColor text = { 200, 200, 200, 255 };
+  RenColor lineno = { 120, 120, 120, 255 };
+  char buf[16];
+
+  rencache_begin_frame();
+  rencache_set_clip_rect((RenRect) { 0, 0, SCREEN_W, SCREEN_H });
+  rencache_draw_rect((RenRect) { 0, 0, SCREEN_W, SCREEN_H }, bg);
+  rencache_draw_rect((RenRect) { 0, 0, 60, SCREEN_H }, gutter);
+  for (int i = 0; i * line_height < SCREEN_H; i++) {
+    int y = i * line_height;
+    int line = i + scroll + 1;
+    snprintf(buf, sizeof(buf), "%d", line);
+    rencache_draw_text(mono, buf, 10, y, lineno);
+    rencache_draw_text(mono, (line % 3) ? ascii_text : utf8_text, 70, y, text);
+  }
+  if (caret) {
+    rencache_draw_rect((RenRect) { 200, 5 * line_height, 2, line_height }, text);
+  }
+  rencache_end_frame();
+}
+
+
+static void setup_rencache(void) {
+  rencache_invalidate();
+  draw_editor_frame(0, false);
+}
+
+
+static void bench_rencache_idle(int n) {
+  for (int i = 0; i < n; i++) {
+    draw_editor_frame(0, false);
+  }
+}
+
+
+static void bench_rencache_caret_blink(int n) {
+  for (int i = 0; i < n; i++) {
+    draw_editor_frame(0, i & 1);
+  }
+}
+
+
+static void bench_rencache_scroll(int n) {
+  for (int i = 0; i < n; i++) {
+    draw_editor_frame(i % 100, false);
+  }
+}
+
+
+static void bench_rencache_full_invalidate(int n) {
+  for (int i = 0; i < n; i++) {
+    rencache_invalidate();
+    draw_editor_frame(0, false);
+  }
+}
+
+
+static void bench_rect_merge(int n) {
+  /* every other cell of a full-screen grid changed: worst case for merging */
+  int max_x = SCREEN_W / CELL_SIZE + 1;
+  int max_y = SCREEN_H / CELL_SIZE + 1;
+  for (int i = 0; i < n; i++) {
+    int count = 0;
+    for (int y = 0; y < max_y; y++) {
+      for (int x = 0; x < max_x; x++) {
+        if ((x + y + i) & 1) { push_rect((RenRect) { x, y, 1, 1 }, &count); }
+      }
+    }
+    sink = count;
+  }
+}
+
+
+static Bench benches[] = {
+  { "ren_draw_rect/opaque",          NULL,           bench_draw_rect_opaque,         400 * 300          },
+  { "ren_draw_rect/blended",         NULL,           bench_draw_rect_blended,        400 * 300          },
+  { "ren_draw_text/ascii",           NULL,           bench_draw_text_ascii,          0                  },
+  { "ren_draw_text/utf8",            NULL,           bench_draw_text_utf8,           0                  },
+  { "ren_get_font_width/ascii",      NULL,           bench_font_width_ascii,         0                  },
+  { "ren_get_font_width/utf8",       NULL,           bench_font_width_utf8,          0                  },
+  { "glyphset_bake",                 NULL,           bench_glyphset_bake,            0                  },
+  { "rencache_end_frame/idle",       setup_rencache, bench_rencache_idle,            0                  },
+  { "rencache_end_frame/caret",      setup_rencache, bench_rencache_caret_blink,     0                  },
+  { "rencache_end_frame/scroll",     setup_rencache, bench_rencache_scroll,          SCREEN_W * SCREEN_H },
+  { "rencache_end_frame/invalidate", setup_rencache, bench_rencache_full_invalidate, SCREEN_W * SCREEN_H },
+  { "rect_merge",                    NULL,           bench_rect_merge,               0                  },
+};
+
+
+int main(int argc, char **argv) {
+  bench_parse_args(argc, argv);
+
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+  SDL_Init(SDL_INIT_VIDEO);
+  SDL_Window *win = SDL_CreateWindow("", 0, 0, SCREEN_W, SCREEN_H, SDL_WINDOW_HIDDEN);
+  ren_init_headless(win, SCREEN_W, SCREEN_H);
+
+  font = ren_load_font("data/fonts/font.ttf", 14);
+  mono = ren_load_font("data/fonts/monospace.ttf", 13.5);
+  if (!font || !mono) {
+    fprintf(stderr, "Error: could not load fonts, run from the repository root\n");
+    return EXIT_FAILURE;
+  }
+  line_height = ren_get_font_height(mono) * 1.2;
+
+  /* text widths are only known once the fonts are loaded */
+  int ascii_w = ren_get_font_width(mono, ascii_text);
+  int utf8_w = ren_get_font_width(font, utf8_text);
+  benches[2].pixels = ascii_w * ren_get_font_height(mono);
+  benches[3].pixels = utf8_w * ren_get_font_height(font);
+
+  bench_run_all("renderer", benches, sizeof(benches) / sizeof(*benches));
+
+  SDL_DestroyWindow(win);
+  SDL_Quit();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+#include "bench.h"
+
+/* main.c is compiled into this file so the benchmarks run on a VM created with
+** exactly the configuration used by the editor */
+#define main lite_main
+#include "../src/main.c"
+#undef main
+
+static WrenVM *vm;
+static WrenHandle *run_method;
+static WrenHandle *bench_class;
+static char *bench_source;
+
+
+static char* read_file(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) { return NULL; }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+  char *buf = malloc(size + 1);
+  if (fread(buf, 1, size, fp) != (size_t) size) {
+    free(buf);
+    fclose(fp);
+    return NULL;
+  }
+  buf[size] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+
+static void free_vm(void) {
+  if (!vm) { return; }
+  wrenReleaseHandle(vm, bench_class);
+  wrenReleaseHandle(vm, run_method);
+  wrenFreeVM(vm);
+  vm = NULL;
+}
+
+
+/* every benchmark gets a fresh VM so heap state doesn't leak between them */
+static void setup_vm(void) {
+  free_vm();
+  WrenConfiguration config;
+  init_config(&config);
+  vm = wrenNewVM(&config);
+
+  if (wrenInterpret(vm, "bench", bench_source) != WREN_RESULT_SUCCESS) {
+    exit(EXIT_FAILURE);
+  }
+  wrenEnsureSlots(vm, 2);
+  wrenGetVariable(vm, "bench", bench_current->arg, 0);
+  bench_class = wrenGetSlotHandle(vm, 0);
+  run_method = wrenMakeCallHandle(vm, "run(_)");
+}
+
+
+static void run_vm(int n) {
+  wrenEnsureSlots(vm, 2);
+  wrenSetSlotHandle(vm, 0, bench_class);
+  wrenSetSlotDouble(vm, 1, n);
+  if (wrenCall(vm, run_method) != WREN_RESULT_SUCCESS) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+#define VM_BENCH(name, class) { name, setup_vm, run_vm, 0, class }
+
+
+/* startup: a fresh VM compiles many modules that each declare their own
+** variables and method names, like an editor loading lots of plugins. This
+** mostly measures how symbols are interned as the symbol tables grow */
+#define STARTUP_MODULES 64
+#define STARTUP_SYMBOLS 48
+
+static char *startup_sources[STARTUP_MODULES];
+
+
+static char* startup_module_source(int module) {
+  size_t size = 256 * STARTUP_SYMBOLS + 256;
+  char *source = malloc(size);
+  size_t len = 0;
+  for (int i = 0; i < STARTUP_SYMBOLS; i++) {
+    len += snprintf(source + len, size - len,
+      "var Plugin%dValue%d = %d\n", module, i, i);
+  }
+  len += snprintf(source + len, size - len,
+    "class Plugin%d {\n  construct new() {}\n", module);
+  for (int i = 0; i < STARTUP_SYMBOLS; i++) {
+    len += snprintf(source + len, size - len,
+      "  plugin%d_method%d(a) { a + Plugin%dValue%d }\n", module, i, module, i);
+  }
+  len += snprintf(source + len, size - len,
+    "}\nvar plugin%d = Plugin%d.new()\n", module, module);
+  for (int i = 0; i < STARTUP_SYMBOLS; i++) {
+    len += snprintf(source + len, size - len,
+      "plugin%d.plugin%d_method%d(%d)\n", module, module, i, i);
+  }
+  return source;
+}
+
+
+static void setup_startup(void) {
+  free_vm();
+  if (startup_sources[0]) { return; }
+  for (int i = 0; i < STARTUP_MODULES; i++) {
+    startup_sources[i] = startup_module_source(i);
+  }
+}
+
+
+static void run_startup(int n) {
+  for (int i = 0; i < n; i++) {
+    WrenConfiguration config;
+    init_config(&config);
+    WrenVM *startup_vm = wrenNewVM(&config);
+    for (int j = 0; j < STARTUP_MODULES; j++) {
+      char name[32];
+      snprintf(name, sizeof(name), "plugin%d", j);
+      if (wrenInterpret(startup_vm, name, startup_sources[j]) != WREN_RESULT_SUCCESS) {
+        exit(EXIT_FAILURE);
+      }
+    }
+    wrenFreeVM(startup_vm);
+  }
+}
+
+static Bench benches[] = {
+  VM_BENCH("dispatch/monomorphic",  "Dispatch"),
+  VM_BENCH("dispatch/polymorphic",  "DispatchPolymorphic"),
+  VM_BENCH("arith/numeric",         "Arithmetic"),
+  VM_BENCH("fields/getter_setter",  "Fields"),
+  VM_BENCH("closures/upvalues",     "Closures"),
+  VM_BENCH("fibers/switch",         "Fibers"),
+  VM_BENCH("string/concat",         "StringConcat"),
+  VM_BENCH("string/interpolation",  "StringInterpolation"),
+  VM_BENCH("string/split",          "StringSplit"),
+  VM_BENCH("string/replace",        "StringReplace"),
+  VM_BENCH("string/build_100",      "StringBuild"),
+  VM_BENCH("list/sort_100",         "ListSort"),
+  VM_BENCH("list/sort_comparer_100", "ListSortComparer"),
+  VM_BENCH("list/sort_strings_100", "ListSortStrings"),
+  VM_BENCH("list/sort_by_100",      "ListSortBy"),
+  VM_BENCH("map/insert",            "MapInsert"),
+  VM_BENCH("map/lookup",            "MapLookup"),
+  VM_BENCH("map/iterate_100",       "MapIterate"),
+  VM_BENCH("gc/allocation_heavy",   "GarbageHeavy"),
+  { "startup/modules", setup_startup, run_startup, 0, NULL },
+};
+
+
+int main(int argc, char **argv) {
+  bench_parse_args(argc, argv);
+
+  bench_source = read_file("bench/vm.wren");
+  if (!bench_source) {
+    fprintf(stderr, "Error: could not read bench/vm.wren, run from the repository root\n");
+    return EXIT_FAILURE;
+  }
+
+  bench_run_all("vm", benches, sizeof(benches) / sizeof(*benches));
+
+  free_vm();
+  free(bench_source);
+  for (int i = 0; i < STARTUP_MODULES; i++) {
+    free(startup_sources[i]);
+  }
+  return EXIT_SUCCESS;
+}
@@ -15,6 +15,9 @@ else
   platform="unix"
   outfile="lite"
   compiler="gcc"
+  lflags="$lflags -lpthread"
+  # the profiler's timer_create() is in librt before glibc 2.34
+  [[ $(uname) == Linux ]] && lflags="$lflags -lrt"
   lflags="$lflags -o $outfile"
 fi
 
@@ -24,6 +24,7 @@ const char *system_source = "class Program {\n"
                             "class Clock {\n"
                             "    foreign static now\n"
                             "    foreign static sleep(ms)\n"
+                            "    foreign static isVirtual\n"
                             "}\n"
                             "\n"
                             "class Events {\n"
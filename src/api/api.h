@@ -23,10 +23,15 @@ extern struct APIContext api_context;
 struct APIContext
 {
     WrenHandle *args;
+    // called after every frame has been drawn, may be NULL
+    void (*on_end_frame)(WrenVM *vm);
 };
 
 int apiAuxCheckOption(WrenVM *vm, int argSlot, const char *def, const char *const *lst);
 
+bool apiRecordEvents(const char *filename);
+bool apiReplayEvents(const char *filename);
+
 WrenForeignMethodFn apiBindForeignMethods(WrenVM *vm, const char *module, const char *className, bool isStatic,
                                           const char *signature);
 
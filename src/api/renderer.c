@@ -32,6 +32,10 @@ static void f_begin_frame(WrenVM *vm)
 static void f_end_frame(WrenVM *vm)
 {
     rencache_end_frame();
+    if (api_context.on_end_frame)
+        api_context.on_end_frame(vm);
+    // do some of the garbage collection every frame instead of pausing once the heap is full
+    wrenCollectGarbageStep(vm);
     RETURN_NULL(vm);
 }
 
@@ -4,8 +4,11 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #ifdef _WIN32
@@ -41,12 +44,183 @@ static char *key_name(char *dst, int sym)
     return dst;
 }
 
+/* events returned by f_poll_event can be written to a file with relative
+** timestamps and fed back later; while replaying, Clock and Events run on a
+** virtual clock so a replay is deterministic and can be used as a benchmark */
+static FILE *record_fp;
+static double record_start;
+
+static FILE *replay_fp;
+static char replay_line[4096];
+static double replay_next; /* timestamp of the buffered line, < 0 at end of file */
+static double virtual_time;
+static double frame_start;
+static double *frame_times;
+static int frame_count, frame_capacity;
+
+static double real_time(void)
+{
+    return SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+bool apiRecordEvents(const char *filename)
+{
+    record_fp = fopen(filename, "wb");
+    record_start = real_time();
+    return record_fp != NULL;
+}
+
+static void replay_read_line(void)
+{
+    replay_next = -1;
+    while (fgets(replay_line, sizeof(replay_line), replay_fp))
+    {
+        if (sscanf(replay_line, "%lf", &replay_next) == 1)
+            return;
+    }
+}
+
+static void record_event(WrenVM *vm)
+{
+    fprintf(record_fp, "%.6f", real_time() - record_start);
+    int count = wrenGetListCount(vm, 0);
+    for (int i = 0; i < count; i++)
+    {
+        wrenGetListElement(vm, 0, i, 1);
+        if (wrenGetSlotType(vm, 1) == WREN_TYPE_NUM)
+        {
+            fprintf(record_fp, "\t%.17g", wrenGetSlotDouble(vm, 1));
+            continue;
+        }
+        int len;
+        const char *p = wrenGetSlotBytes(vm, 1, &len);
+        fputs("\t\"", record_fp);
+        for (; len > 0; len--, p++)
+        {
+            switch (*p)
+            {
+            case '\t':
+                fputs("\\t", record_fp);
+                break;
+            case '\n':
+                fputs("\\n", record_fp);
+                break;
+            case '\\':
+                fputs("\\\\", record_fp);
+                break;
+            default:
+                fputc(*p, record_fp);
+            }
+        }
+    }
+    fputc('\n', record_fp);
+    fflush(record_fp);
+}
+
+static void replay_event(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotNewList(vm, 0);
+
+    char *field = strchr(replay_line, '\t');
+    while (field)
+    {
+        char *p = ++field;
+        field = strchr(field, '\t');
+        if (field)
+            *field = '\0';
+
+        if (*p == '"')
+        {
+            char *src = p + 1, *dst = p;
+            for (; *src && *src != '\n'; src++, dst++)
+            {
+                if (*src == '\\' && src[1])
+                {
+                    src++;
+                    *dst = *src == 't' ? '\t' : *src == 'n' ? '\n' : *src;
+                }
+                else
+                    *dst = *src;
+            }
+            wrenSetSlotBytes(vm, 1, p, dst - p);
+        }
+        else
+            wrenSetSlotDouble(vm, 1, strtod(p, NULL));
+        wrenInsertInList(vm, 0, -1, 1);
+    }
+
+    wrenGetListElement(vm, 0, 0, 1);
+    if (!strcmp(wrenGetSlotString(vm, 1), "exposed"))
+        rencache_invalidate();
+
+    replay_read_line();
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void replay_summary(void)
+{
+    if (frame_count == 0)
+        return;
+    double total = 0;
+    for (int i = 0; i < frame_count; i++)
+        total += frame_times[i];
+    qsort(frame_times, frame_count, sizeof(double), compare_doubles);
+    printf("replay: %d frames, total %.3f ms, mean %.3f ms, p50 %.3f ms, p95 %.3f ms, max %.3f ms\n", frame_count,
+           total, total / frame_count, frame_times[frame_count / 2], frame_times[frame_count * 95 / 100],
+           frame_times[frame_count - 1]);
+}
+
+/* called once per main loop iteration while replaying */
+static void replay_end_frame(void)
+{
+    double now = real_time();
+    if (frame_count == frame_capacity)
+    {
+        frame_capacity = frame_capacity ? frame_capacity * 2 : 1024;
+        frame_times = realloc(frame_times, frame_capacity * sizeof(double));
+    }
+    double ms = (now - frame_start) * 1000;
+    frame_times[frame_count++] = ms;
+    printf("frame\t%d\t%.4f\t%.3f\n", frame_count, virtual_time, ms);
+    frame_start = now;
+
+    /* the recording is exhausted and its last event has been handled */
+    if (replay_next < 0)
+        exit(EXIT_SUCCESS);
+}
+
+bool apiReplayEvents(const char *filename)
+{
+    replay_fp = fopen(filename, "rb");
+    if (!replay_fp)
+        return false;
+    replay_read_line();
+    frame_start = real_time();
+    atexit(replay_summary);
+    return true;
+}
+
 static void f_poll_event(WrenVM *vm)
 {
     char buf[16];
     int mx, my, wx, wy;
     SDL_Event e;
 
+    if (replay_fp)
+    {
+        if (replay_next >= 0 && replay_next <= virtual_time)
+            replay_event(vm);
+        else
+            RETURN_NULL(vm);
+        return;
+    }
+
 top:
     if (!SDL_PollEvent(&e))
     {
@@ -76,13 +250,13 @@ top:
             INSERT_IN_LIST(String, 0, "resized");
             INSERT_IN_LIST(Double, 1, e.window.data1);
             INSERT_IN_LIST(Double, 2, e.window.data2);
-            return;
+            break;
         }
         else if (e.window.event == SDL_WINDOWEVENT_EXPOSED)
         {
             rencache_invalidate();
             INSERT_IN_LIST(String, 0, "exposed");
-            return;
+            break;
         }
         /* on some systems, when alt-tabbing to the window SDL will queue up
         ** several KEYDOWN events for the `tab` key; we flush all keydown
@@ -101,22 +275,22 @@ top:
         INSERT_IN_LIST(Double, 2, mx - wx);
         INSERT_IN_LIST(Double, 3, my - wy);
         SDL_free(e.drop.file);
-        return;
+        break;
 
     case SDL_KEYDOWN:
         INSERT_IN_LIST(String, 0, "keypressed");
         INSERT_IN_LIST(String, 1, key_name(buf, e.key.keysym.sym));
-        return;
+        break;
 
     case SDL_KEYUP:
         INSERT_IN_LIST(String, 0, "keyreleased");
         INSERT_IN_LIST(String, 1, key_name(buf, e.key.keysym.sym));
-        return;
+        break;
 
     case SDL_TEXTINPUT:
         INSERT_IN_LIST(String, 0, "textinput");
         INSERT_IN_LIST(String, 1, e.text.text);
-        return;
+        break;
 
     case SDL_MOUSEBUTTONDOWN:
         if (e.button.button == 1)
@@ -126,7 +300,7 @@ top:
         INSERT_IN_LIST(Double, 2, e.button.x);
         INSERT_IN_LIST(Double, 3, e.button.y);
         INSERT_IN_LIST(Double, 4, e.button.clicks);
-        return;
+        break;
 
     case SDL_MOUSEBUTTONUP:
         if (e.button.button == 1)
@@ -135,7 +309,7 @@ top:
         INSERT_IN_LIST(String, 1, button_name(e.button.button));
         INSERT_IN_LIST(Double, 2, e.button.x);
         INSERT_IN_LIST(Double, 3, e.button.y);
-        return;
+        break;
 
     case SDL_MOUSEMOTION:
         INSERT_IN_LIST(String, 0, "mousemoved");
@@ -143,23 +317,33 @@ top:
         INSERT_IN_LIST(Double, 2, e.motion.y);
         INSERT_IN_LIST(Double, 3, e.motion.xrel);
         INSERT_IN_LIST(Double, 4, e.motion.yrel);
-        return;
+        break;
 
     case SDL_MOUSEWHEEL:
         INSERT_IN_LIST(String, 0, "mousewheel");
         INSERT_IN_LIST(Double, 1, e.wheel.y);
-        return;
+        break;
 
     default:
         goto top;
     }
 
+    if (record_fp)
+        record_event(vm);
+
 #undef INSERT_IN_LIST
 }
 
 static void f_wait_event(WrenVM *vm)
 {
     double n = wrenGetSlotDouble(vm, 1);
+    if (replay_fp)
+    {
+        bool has_event = replay_next >= 0 && replay_next <= virtual_time + n;
+        virtual_time = has_event ? fmax(virtual_time, replay_next) : virtual_time + n;
+        RETURN_BOOL(vm, has_event);
+        return;
+    }
     RETURN_BOOL(vm, SDL_WaitEventTimeout(NULL, n * 1000));
 }
 
@@ -350,12 +534,24 @@ static void f_set_clipboard(WrenVM *vm)
 
 static void f_now(WrenVM *vm)
 {
-    RETURN_NUM(vm, SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency());
+    RETURN_NUM(vm, replay_fp ? virtual_time : real_time());
+}
+
+static void f_is_virtual(WrenVM *vm)
+{
+    RETURN_BOOL(vm, replay_fp != NULL);
 }
 
 static void f_sleep(WrenVM *vm)
 {
     double n = wrenGetSlotDouble(vm, 1);
+    if (replay_fp)
+    {
+        virtual_time += n;
+        RETURN_NULL(vm);
+        replay_end_frame();
+        return;
+    }
     SDL_Delay(n * 1000);
     RETURN_NULL(vm);
 }
@@ -481,6 +677,8 @@ WrenForeignMethodFn apiBindSystemMethods(WrenVM *vm, const char *className, bool
             return f_now;
         else if (!strcmp(signature, "sleep(_)"))
             return f_sleep;
+        else if (!strcmp(signature, "isVirtual"))
+            return f_is_virtual;
     }
     else if (!strcmp(className, "Events"))
     {
@@ -266,6 +266,43 @@ typedef struct
   // If zero, defaults to 50.
   int heapGrowthPercent;
 
+  // The number of objects the garbage collector marks or sweeps in one call to
+  // [wrenCollectGarbageStep()].
+  //
+  // If zero, collections are done all at once when the heap grows past the
+  // threshold, pausing the program for as long as it takes to trace and sweep
+  // the whole heap. Otherwise, crossing the threshold only starts a
+  // collection, and the host is expected to call [wrenCollectGarbageStep()]
+  // regularly, for example once per frame, to spread the rest of the work out.
+  // If the heap grows to twice the threshold before the collection is done, it
+  // is finished all at once.
+  //
+  // Defaults to zero.
+  int gcStepSize;
+
+  // When the program has idle time to spare, it can do garbage collection
+  // work with `System.gcStep(budget)`. This number determines how much the
+  // heap may grow after a collection before such idle time is used to start
+  // the next one, as a percentage of the memory still in use.
+  //
+  // Keeping this well below [heapGrowthPercent] means that most collections
+  // happen while idle instead of when an allocation crosses the threshold.
+  //
+  // If zero, idle time is only used to start a collection that is already
+  // due. Defaults to zero.
+  int idleHeapGrowthPercent;
+
+  // If true, Wren serves its small allocations, which are most of them, from
+  // pages of equally sized blocks that it carves out of 1MB chunks it gets
+  // from [reallocateFn]. Allocations larger than 512 bytes still go to
+  // [reallocateFn] directly.
+  //
+  // This makes allocating and freeing objects cheaper and keeps the heap
+  // compact, at the cost of holding on to some memory that is free.
+  //
+  // Defaults to false.
+  bool useSlabAllocator;
+
   // User-defined data associated with the VM.
   void* userData;
 
@@ -319,6 +356,12 @@ WREN_API void wrenFreeVM(WrenVM* vm);
 // Immediately run the garbage collector to free unused memory.
 WREN_API void wrenCollectGarbage(WrenVM* vm);
 
+// Does one step of an incremental garbage collection, as configured by
+// [gcStepSize], starting a new collection if one is due.
+//
+// Returns true if a collection is still in progress afterwards.
+WREN_API bool wrenCollectGarbageStep(WrenVM* vm);
+
 // Runs [source], a string of Wren source code in a new fiber in [vm] in the
 // context of resolved [module].
 WREN_API WrenInterpretResult wrenInterpret(WrenVM* vm, const char* module,
@@ -415,7 +458,12 @@ WREN_API bool wrenGetSlotBool(WrenVM* vm, int slot);
 // Returns a pointer to the first byte of the array and fill [length] with the
 // number of bytes in the array.
 //
-// It is an error to call this if the slot does not contain a string.
+// If the slot contains a StringBuilder, this returns its bytes directly
+// without copying them into a string. The pointer is only valid until the
+// builder is next modified.
+//
+// It is an error to call this if the slot does not contain a string or a
+// StringBuilder.
 WREN_API const char* wrenGetSlotBytes(WrenVM* vm, int slot, int* length);
 
 // Reads a number from [slot].
@@ -436,7 +484,10 @@ WREN_API void* wrenGetSlotForeign(WrenVM* vm, int slot);
 // while in your foreign method, but cannot keep a pointer to it after the
 // function returns, since the garbage collector may reclaim it.
 //
-// It is an error to call this if the slot does not contain a string.
+// Like [wrenGetSlotBytes], this also accepts a StringBuilder.
+//
+// It is an error to call this if the slot does not contain a string or a
+// StringBuilder.
 WREN_API const char* wrenGetSlotString(WrenVM* vm, int slot);
 
 // Creates a handle for the value stored in [slot].
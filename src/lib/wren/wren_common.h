@@ -44,6 +44,16 @@
   #endif
 #endif
 
+// If true, the objects a garbage collection finds unreachable are freed on a
+// background thread, so that the collector only has to unlink them. Finalizers
+// of foreign objects still run on the VM's thread. The host's `reallocateFn`
+// must be safe to call from another thread to free memory.
+//
+// Defaults to on, unless memory operations are traced.
+#ifndef WREN_BACKGROUND_SWEEP
+  #define WREN_BACKGROUND_SWEEP 1
+#endif
+
 // The VM includes a number of optional modules. You can choose to include
 // these or not. By default, they are all available. To disable one, set the
 // corresponding `WREN_OPT_<name>` define to `0`.
@@ -55,6 +65,10 @@
   #define WREN_OPT_RANDOM 1
 #endif
 
+#ifndef WREN_OPT_PROFILER
+  #define WREN_OPT_PROFILER 1
+#endif
+
 // These flags are useful for debugging and hacking on Wren itself. They are not
 // intended to be used for production code. They default to off.
 
@@ -66,6 +80,12 @@
 // Set this to true to log memory operations as they occur.
 #define WREN_DEBUG_TRACE_MEMORY 0
 
+#if WREN_DEBUG_TRACE_MEMORY
+  // Freed objects are printed, which can't be done on another thread.
+  #undef WREN_BACKGROUND_SWEEP
+  #define WREN_BACKGROUND_SWEEP 0
+#endif
+
 // Set this to true to log garbage collections as they occur.
 #define WREN_DEBUG_TRACE_GC 0
 
@@ -75,6 +95,20 @@
 // Set this to trace each instruction as it's executed.
 #define WREN_DEBUG_TRACE_INSTRUCTIONS 0
 
+// Set this to true to count the instructions executed per opcode and per
+// function, and the calls made through each method symbol. The counts can be
+// read with `Meta.executionCounts` and printed with wrenDumpExecutionCounts().
+#ifndef WREN_DEBUG_COUNT_EXECUTION
+  #define WREN_DEBUG_COUNT_EXECUTION 0
+#endif
+
+// Set this to true to attribute every allocation to the kind of object and the
+// Wren function and line that made it. See `Meta.allocations` and
+// wrenDumpAllocations().
+#ifndef WREN_DEBUG_TRACK_ALLOCATIONS
+  #define WREN_DEBUG_TRACK_ALLOCATIONS 0
+#endif
+
 // The maximum number of module-level variables that may be defined at one time.
 // This limitation comes from the 16 bits used for the arguments to
 // `CODE_LOAD_MODULE_VAR` and `CODE_STORE_MODULE_VAR`.
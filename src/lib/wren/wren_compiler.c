@@ -33,6 +33,10 @@
 // two-byte argument.
 #define MAX_CONSTANTS (1 << 16)
 
+// The maximum number of method calls a single function can contain. Each call
+// has its own inline cache whose index is a two-byte argument.
+#define MAX_CALL_CACHES (1 << 16)
+
 // The maximum distance a CODE_JUMP or CODE_JUMP_IF instruction can move the
 // instruction pointer.
 #define MAX_JUMP (1 << 16)
@@ -43,6 +47,10 @@
 //      "outside %(one + "%(two + "%(three)")")"
 #define MAX_INTERPOLATION_NESTING 8
 
+// The maximum number of string parts and values a single interpolated string
+// can join. The count is a two-byte argument to `CODE_INTERPOLATE`.
+#define MAX_INTERPOLATION_PARTS ((1 << 16) - 1)
+
 // The buffer size used to format a compile error message, excluding the header
 // with the module name and error location. Using a hardcoded buffer for this
 // is kind of hairy, but fortunately we can control what the longest possible
@@ -367,6 +375,10 @@ struct sCompiler
   // Whether or not the compiler is for a constructor initializer
   bool isInitializer;
 
+  // The number of method calls emitted so far, each of which gets its own
+  // inline cache.
+  int numCallCaches;
+
   // The number of attributes seen while parsing.
   // We track this separately as compile time attributes
   // are not stored, so we can't rely on attributes->count
@@ -408,6 +420,7 @@ static void emitClassAttributes(Compiler* compiler, ClassInfo* classInfo);
 static void copyAttributes(Compiler* compiler, ObjMap* into);
 static void copyMethodAttributes(Compiler* compiler, bool isForeign, 
             bool isStatic, const char* fullSignature, int32_t length);
+static void optimizeCode(Compiler* compiler);
 
 // The stack effect of each opcode. The index in the array is the opcode, and
 // the value is the stack effect of that instruction.
@@ -497,17 +510,29 @@ static int addConstant(Compiler* compiler, Value constant)
 {
   if (compiler->parser->hasError) return -1;
   
-  // See if we already have a constant for the value. If so, reuse it.
+  // See if we already have a constant for the value. If so, reuse it. Without
+  // NaN tagging the map compares numbers with ==, so make sure a number found
+  // has the same bits. Otherwise -0 could turn into 0.
   if (compiler->constants != NULL)
   {
     Value existing = wrenMapGet(compiler->constants, constant);
-    if (IS_NUM(existing)) return (int)AS_NUM(existing);
+    if (IS_NUM(existing))
+    {
+      int index = (int)AS_NUM(existing);
+      Value found = compiler->fn->constants.data[index];
+      if (!IS_NUM(constant) ||
+          wrenDoubleToBits(AS_NUM(found)) == wrenDoubleToBits(AS_NUM(constant)))
+      {
+        return index;
+      }
+    }
   }
   
   // It's a new constant.
   if (compiler->fn->constants.count < MAX_CONSTANTS)
   {
     if (IS_OBJ(constant)) wrenPushRoot(compiler->parser->vm, AS_OBJ(constant));
+    wrenWriteBarrier(compiler->parser->vm, (Obj*)compiler->fn);
     wrenValueBufferWrite(compiler->parser->vm, &compiler->fn->constants,
                          constant);
     if (IS_OBJ(constant)) wrenPopRoot(compiler->parser->vm);
@@ -537,6 +562,7 @@ static void initCompiler(Compiler* compiler, Parser* parser, Compiler* parent,
   compiler->loop = NULL;
   compiler->enclosingClass = NULL;
   compiler->isInitializer = false;
+  compiler->numCallCaches = 0;
   
   // Initialize these to NULL before allocating in case a GC gets triggered in
   // the middle of initializing the compiler.
@@ -1356,6 +1382,18 @@ static void emitShortArg(Compiler* compiler, Code instruction, int arg)
   emitShort(compiler, arg);
 }
 
+// Emits the index of a new inline cache for the call instruction just emitted.
+static void emitCallCache(Compiler* compiler)
+{
+  if (compiler->numCallCaches == MAX_CALL_CACHES)
+  {
+    error(compiler, "A function may only contain %d method calls.",
+          MAX_CALL_CACHES);
+  }
+
+  emitShort(compiler, compiler->numCallCaches++ & 0xffff);
+}
+
 // Emits [instruction] followed by a placeholder for a jump offset. The
 // placeholder can be patched by calling [jumpPatch]. Returns the index of the
 // placeholder.
@@ -1671,9 +1709,12 @@ static ObjFn* endCompiler(Compiler* compiler,
   // Mark the end of the bytecode. Since it may contain multiple early returns,
   // we can't rely on CODE_RETURN to tell us we're at the end.
   emitOp(compiler, CODE_END);
+  optimizeCode(compiler);
 
   wrenFunctionBindName(compiler->parser->vm, compiler->fn,
                        debugName, debugNameLength);
+  wrenFunctionInitCallCaches(compiler->parser->vm, compiler->fn,
+                             compiler->numCallCaches);
   
   // In the function that contains this one, load the resulting function object.
   if (compiler->parent != NULL)
@@ -1989,6 +2030,8 @@ static void callSignature(Compiler* compiler, Code instruction,
     // superclass then and store it in the constant slot.
     emitShort(compiler, addConstant(compiler, NULL_VAL));
   }
+
+  emitCallCache(compiler);
 }
 
 // Compiles a method call with [numArgs] for a method with [name] with [length].
@@ -1997,6 +2040,7 @@ static void callMethod(Compiler* compiler, int numArgs, const char* name,
 {
   int symbol = methodSymbol(compiler, name, length);
   emitShortArg(compiler, (Code)(CODE_CALL_0 + numArgs), symbol);
+  emitCallCache(compiler);
 }
 
 // Compiles an (optional) argument list for a method call with [methodSignature]
@@ -2423,43 +2467,60 @@ static void literal(Compiler* compiler, bool canAssign)
   emitConstant(compiler, compiler->parser->previous.value);
 }
 
+// Pushes the string part of an interpolation that was just consumed, unless
+// it's empty. Returns the number of values pushed.
+static int interpolationPart(Compiler* compiler)
+{
+  if (AS_STRING(compiler->parser->previous.value)->length == 0) return 0;
+
+  literal(compiler, false);
+  return 1;
+}
+
 // A string literal that contains interpolated expressions.
 //
-// Interpolation is syntactic sugar for calling ".join()" on a list. So the
-// string:
+// The string parts and the interpolated values, converted with "toString", are
+// pushed onto the stack and joined by a single instruction that allocates the
+// result once. So the string:
 //
 //     "a %(b + c) d"
 //
 // is compiled roughly like:
 //
-//     ["a ", b + c, " d"].join()
+//     "a " (b + c).toString " d" INTERPOLATE 3
 static void stringInterpolation(Compiler* compiler, bool canAssign)
 {
-  // Instantiate a new list.
-  loadCoreVariable(compiler, "List");
-  callMethod(compiler, 0, "new()", 5);
-  
+  int numParts = 0;
   do
   {
     // The opening string part.
-    literal(compiler, false);
-    callMethod(compiler, 1, "addCore_(_)", 11);
-    
+    numParts += interpolationPart(compiler);
+
     // The interpolated expression.
     ignoreNewlines(compiler);
     expression(compiler);
-    callMethod(compiler, 1, "addCore_(_)", 11);
-    
+    emitShortArg(compiler, CODE_TO_STRING,
+                 methodSymbol(compiler, "toString", 8));
+    emitCallCache(compiler);
+    numParts++;
+
     ignoreNewlines(compiler);
   } while (match(compiler, TOKEN_INTERPOLATION));
-  
+
   // The trailing string part.
   consume(compiler, TOKEN_STRING, "Expect end of string interpolation.");
-  literal(compiler, false);
-  callMethod(compiler, 1, "addCore_(_)", 11);
-  
-  // The list of interpolated parts.
-  callMethod(compiler, 0, "join()", 6);
+  numParts += interpolationPart(compiler);
+
+  if (numParts > MAX_INTERPOLATION_PARTS)
+  {
+    error(compiler, "A string may only contain %d interpolated parts.",
+          MAX_INTERPOLATION_PARTS);
+  }
+
+  // The instruction pops all but one of the parts, which its stack effect
+  // can't tell.
+  emitShortArg(compiler, CODE_INTERPOLATE, numParts);
+  compiler->numSlots -= numParts - 1;
 }
 
 static void super_(Compiler* compiler, bool canAssign)
@@ -2582,7 +2643,8 @@ static void conditional(Compiler* compiler, bool canAssign)
 
 void infixOp(Compiler* compiler, bool canAssign)
 {
-  GrammarRule* rule = getRule(compiler->parser->previous.type);
+  TokenType operatorType = compiler->parser->previous.type;
+  GrammarRule* rule = getRule(operatorType);
 
   // An infix operator cannot end an expression.
   ignoreNewlines(compiler);
@@ -2590,9 +2652,33 @@ void infixOp(Compiler* compiler, bool canAssign)
   // Compile the right-hand side.
   parsePrecedence(compiler, (Precedence)(rule->precedence + 1));
 
-  // Call the operator method on the left-hand side.
+  // Call the operator method on the left-hand side. The arithmetic and
+  // comparison operators get their own instructions so that the interpreter
+  // can skip the call when both operands are numbers.
   Signature signature = { rule->name, (int)strlen(rule->name), SIG_METHOD, 1 };
-  callSignature(compiler, CODE_CALL_0, &signature);
+
+  Code instruction;
+  switch (operatorType)
+  {
+    case TOKEN_PLUS:    instruction = CODE_ADD; break;
+    case TOKEN_MINUS:   instruction = CODE_SUBTRACT; break;
+    case TOKEN_STAR:    instruction = CODE_MULTIPLY; break;
+    case TOKEN_SLASH:   instruction = CODE_DIVIDE; break;
+    case TOKEN_PERCENT: instruction = CODE_MODULO; break;
+    case TOKEN_LT:      instruction = CODE_LESS; break;
+    case TOKEN_GT:      instruction = CODE_GREATER; break;
+    case TOKEN_LTEQ:    instruction = CODE_LESS_EQUAL; break;
+    case TOKEN_GTEQ:    instruction = CODE_GREATER_EQUAL; break;
+    case TOKEN_EQEQ:    instruction = CODE_EQUAL; break;
+    case TOKEN_BANGEQ:  instruction = CODE_NOT_EQUAL; break;
+
+    default:
+      callSignature(compiler, CODE_CALL_0, &signature);
+      return;
+  }
+
+  emitShortArg(compiler, instruction, signatureSymbol(compiler, &signature));
+  emitCallCache(compiler);
 }
 
 // Compiles a method signature for an infix operator.
@@ -2821,7 +2907,22 @@ static GrammarRule* getRule(TokenType type)
 }
 
 // The main entrypoint for the top-down operator precedence parser.
-void parsePrecedence(Compiler* compiler, Precedence precedence)
+// Compiles the infix operators that follow an operand, as long as they bind at
+// least as tightly as [precedence].
+static void parseInfix(Compiler* compiler, Precedence precedence,
+                       bool canAssign)
+{
+  while (precedence <= rules[compiler->parser->current.type].precedence)
+  {
+    nextToken(compiler->parser);
+    GrammarFn infix = rules[compiler->parser->previous.type].infix;
+    infix(compiler, canAssign);
+  }
+}
+
+// Compiles the prefix expression starting at the next token. Returns false if
+// there isn't one.
+static bool parsePrefix(Compiler* compiler, bool canAssign)
 {
   nextToken(compiler->parser);
   GrammarFn prefix = rules[compiler->parser->previous.type].prefix;
@@ -2829,9 +2930,15 @@ void parsePrecedence(Compiler* compiler, Precedence precedence)
   if (prefix == NULL)
   {
     error(compiler, "Expected expression.");
-    return;
+    return false;
   }
 
+  prefix(compiler, canAssign);
+  return true;
+}
+
+void parsePrecedence(Compiler* compiler, Precedence precedence)
+{
   // Track if the precendence of the surrounding expression is low enough to
   // allow an assignment inside this one. We can't compile an assignment like
   // a normal expression because it requires us to handle the LHS specially --
@@ -2840,14 +2947,9 @@ void parsePrecedence(Compiler* compiler, Precedence precedence)
   // we pass in whether or not it appears in a context loose enough to allow
   // "=". If so, it will parse the "=" itself and handle it appropriately.
   bool canAssign = precedence <= PREC_CONDITIONAL;
-  prefix(compiler, canAssign);
+  if (!parsePrefix(compiler, canAssign)) return;
 
-  while (precedence <= rules[compiler->parser->current.type].precedence)
-  {
-    nextToken(compiler->parser);
-    GrammarFn infix = rules[compiler->parser->previous.type].infix;
-    infix(compiler, canAssign);
-  }
+  parseInfix(compiler, precedence, canAssign);
 }
 
 // Parses an expression. Unlike statements, expressions leave a resulting value
@@ -2890,10 +2992,12 @@ static int getByteCountForArguments(const uint8_t* bytecode,
 
     case CODE_LOAD_LOCAL:
     case CODE_STORE_LOCAL:
+    case CODE_STORE_LOCAL_POP:
     case CODE_LOAD_UPVALUE:
     case CODE_STORE_UPVALUE:
     case CODE_LOAD_FIELD_THIS:
     case CODE_STORE_FIELD_THIS:
+    case CODE_STORE_FIELD_THIS_POP:
     case CODE_LOAD_FIELD:
     case CODE_STORE_FIELD:
     case CODE_CLASS:
@@ -2902,6 +3006,19 @@ static int getByteCountForArguments(const uint8_t* bytecode,
     case CODE_CONSTANT:
     case CODE_LOAD_MODULE_VAR:
     case CODE_STORE_MODULE_VAR:
+    case CODE_STORE_MODULE_VAR_POP:
+    case CODE_INTERPOLATE:
+    case CODE_JUMP:
+    case CODE_LOOP:
+    case CODE_JUMP_IF:
+    case CODE_AND:
+    case CODE_OR:
+    case CODE_METHOD_INSTANCE:
+    case CODE_METHOD_STATIC:
+    case CODE_IMPORT_MODULE:
+    case CODE_IMPORT_VARIABLE:
+      return 2;
+
     case CODE_CALL_0:
     case CODE_CALL_1:
     case CODE_CALL_2:
@@ -2919,16 +3036,30 @@ static int getByteCountForArguments(const uint8_t* bytecode,
     case CODE_CALL_14:
     case CODE_CALL_15:
     case CODE_CALL_16:
-    case CODE_JUMP:
-    case CODE_LOOP:
-    case CODE_JUMP_IF:
-    case CODE_AND:
-    case CODE_OR:
-    case CODE_METHOD_INSTANCE:
-    case CODE_METHOD_STATIC:
-    case CODE_IMPORT_MODULE:
-    case CODE_IMPORT_VARIABLE:
-      return 2;
+    case CODE_ADD:
+    case CODE_SUBTRACT:
+    case CODE_MULTIPLY:
+    case CODE_DIVIDE:
+    case CODE_MODULO:
+    case CODE_LESS:
+    case CODE_GREATER:
+    case CODE_LESS_EQUAL:
+    case CODE_GREATER_EQUAL:
+    case CODE_EQUAL:
+    case CODE_NOT_EQUAL:
+    case CODE_FOR_RANGE:
+    case CODE_TO_STRING:
+      return 4;
+
+    case CODE_FOR_RANGE_VALUE:
+    case CODE_CALL_FIELD_THIS_0:
+      return 5;
+
+    case CODE_FOR_RANGE_ITERATE:
+      return 6;
+
+    case CODE_CALL_LOCAL_CONSTANT:
+      return 8;
 
     case CODE_SUPER_0:
     case CODE_SUPER_1:
@@ -2947,7 +3078,7 @@ static int getByteCountForArguments(const uint8_t* bytecode,
     case CODE_SUPER_14:
     case CODE_SUPER_15:
     case CODE_SUPER_16:
-      return 4;
+      return 6;
 
     case CODE_CLOSURE:
     {
@@ -2963,6 +3094,484 @@ static int getByteCountForArguments(const uint8_t* bytecode,
   return 0;
 }
 
+// Optimization ----------------------------------------------------------------
+
+// The state of the pass that rewrites a finished function's bytecode. The new
+// code is built up separately and replaces the function's once it's done.
+typedef struct
+{
+  Compiler* compiler;
+
+  // The original bytecode and its line table. Folding adds constants to the
+  // function, which may move its constant table, so constants are always read
+  // through [compiler] instead.
+  const uint8_t* code;
+  const int* lines;
+
+  // Whether the instruction at each offset of [code] can ever run, and whether
+  // a jump lands on it. Nothing is ever fused across jump targets.
+  bool* isReachable;
+  bool* isTarget;
+
+  ByteBuffer newCode;
+  IntBuffer newLines;
+
+  // The offset in [newCode] where each instruction of [code] ended up.
+  int* newOffsets;
+
+  // For each instruction written to [newCode] so far, its offset and the
+  // offset in [code] of the (first) instruction it came from.
+  int* starts;
+  int* origins;
+  int numWritten;
+
+  // The jumps written to [newCode] and the offsets in [code] they go to. They
+  // are patched once every instruction has moved.
+  int* jumps;
+  int* jumpTargets;
+  int numJumps;
+} Optimizer;
+
+// Returns the offset that the jump instruction at [ip] lands on, or -1 if the
+// instruction isn't a jump.
+static int jumpTarget(const uint8_t* code, int ip)
+{
+  switch ((Code)code[ip])
+  {
+    case CODE_JUMP:
+    case CODE_JUMP_IF:
+    case CODE_AND:
+    case CODE_OR:
+      return ip + 3 + ((code[ip + 1] << 8) | code[ip + 2]);
+
+    case CODE_LOOP:
+      return ip + 3 - ((code[ip + 1] << 8) | code[ip + 2]);
+
+    default:
+      return -1;
+  }
+}
+
+// Starts a new instruction in the optimized code that came from the one at
+// [origin] in the original code.
+static void startInstruction(Optimizer* optimizer, int origin)
+{
+  optimizer->starts[optimizer->numWritten] = optimizer->newCode.count;
+  optimizer->origins[optimizer->numWritten] = origin;
+  optimizer->numWritten++;
+}
+
+static void writeByte(Optimizer* optimizer, int byte, int line)
+{
+  ASSERT(optimizer->newCode.count < optimizer->newCode.capacity,
+         "Optimized code should not be longer than the original.");
+  optimizer->newCode.data[optimizer->newCode.count++] = (uint8_t)byte;
+  optimizer->newLines.data[optimizer->newLines.count++] = line;
+}
+
+// Copies the instruction at [ip] that ends before [next] unchanged.
+static void copyInstruction(Optimizer* optimizer, int ip, int next)
+{
+  startInstruction(optimizer, ip);
+  for (int i = ip; i < next; i++)
+  {
+    writeByte(optimizer, optimizer->code[i], optimizer->lines[i]);
+  }
+}
+
+// Returns the opcode of the instruction written [back] instructions ago, if
+// the instructions after it can be fused with it, and the one at [ip] with
+// them. Otherwise returns CODE_END.
+static Code fusableInstruction(Optimizer* optimizer, int back, int ip)
+{
+  if (optimizer->numWritten < back || optimizer->isTarget[ip]) return CODE_END;
+
+  // The instructions after the one we look at must not be jump targets. The
+  // first one may be, since a jump to it still runs the whole fused sequence.
+  for (int i = optimizer->numWritten - back + 1; i < optimizer->numWritten; i++)
+  {
+    if (optimizer->isTarget[optimizer->origins[i]]) return CODE_END;
+  }
+
+  int start = optimizer->starts[optimizer->numWritten - back];
+  return (Code)optimizer->newCode.data[start];
+}
+
+// Discards the last [count] instructions written, so that they can be replaced
+// by a fused one. Returns the offset in the original code of the first one.
+static int unwriteInstructions(Optimizer* optimizer, int count)
+{
+  optimizer->numWritten -= count;
+  int start = optimizer->starts[optimizer->numWritten];
+  optimizer->newCode.count = start;
+  optimizer->newLines.count = start;
+  return optimizer->origins[optimizer->numWritten];
+}
+
+// Returns the value of the constant loaded by the CONSTANT instruction
+// written [back] instructions ago.
+static Value writtenConstant(Optimizer* optimizer, int back)
+{
+  const uint8_t* bytes = optimizer->newCode.data +
+      optimizer->starts[optimizer->numWritten - back];
+  return optimizer->compiler->fn->constants.data[(bytes[1] << 8) | bytes[2]];
+}
+
+// Writes an instruction that loads [value] in place of ones that came from
+// [origin] in the original code.
+static void writeValue(Optimizer* optimizer, Value value, int origin)
+{
+  int line = optimizer->lines[origin];
+  startInstruction(optimizer, origin);
+
+  if (IS_BOOL(value))
+  {
+    writeByte(optimizer, AS_BOOL(value) ? CODE_TRUE : CODE_FALSE, line);
+    return;
+  }
+
+  int constant = addConstant(optimizer->compiler, value);
+  writeByte(optimizer, CODE_CONSTANT, line);
+  writeByte(optimizer, (constant >> 8) & 0xff, line);
+  writeByte(optimizer, constant & 0xff, line);
+}
+
+// Computes [instruction] on constants [a] and [b] when the result is known at
+// compile time and stores it in [result].
+static bool foldOperator(Compiler* compiler, Code instruction, Value a, Value b,
+                         Value* result)
+{
+  WrenVM* vm = compiler->parser->vm;
+
+  // Folding may need a new constant, so leave it if there's no room for one.
+  if (compiler->fn->constants.count >= MAX_CONSTANTS) return false;
+
+  if (IS_NUM(a) && IS_NUM(b))
+  {
+    // If Num's operators have been replaced, they must be called at runtime.
+    return vm->numOperatorsBuiltin &&
+           wrenNumOperator(instruction, AS_NUM(a), AS_NUM(b), result);
+  }
+
+  if (IS_STRING(a) && IS_STRING(b))
+  {
+    switch (instruction)
+    {
+      case CODE_ADD:
+        *result = wrenStringFormat(vm, "@@", a, b);
+        return true;
+
+      case CODE_EQUAL:
+        *result = BOOL_VAL(wrenValuesEqual(a, b));
+        return true;
+
+      case CODE_NOT_EQUAL:
+        *result = BOOL_VAL(!wrenValuesEqual(a, b));
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  return false;
+}
+
+// Tries to replace the instructions written last and the call [instruction] at
+// [ip] with something cheaper. Returns false if they were left alone.
+static bool optimizeCall(Optimizer* optimizer, Code instruction, int ip)
+{
+  WrenVM* vm = optimizer->compiler->parser->vm;
+  const uint8_t* code = optimizer->code;
+  int symbol = (code[ip + 1] << 8) | code[ip + 2];
+  int line = optimizer->lines[ip];
+
+  // `-` on a number constant becomes a negative constant.
+  if (instruction == CODE_CALL_0 &&
+      fusableInstruction(optimizer, 1, ip) == CODE_CONSTANT &&
+      vm->numOperatorsBuiltin &&
+      IS_NUM(writtenConstant(optimizer, 1)) &&
+      optimizer->compiler->fn->constants.count < MAX_CONSTANTS &&
+      symbol == wrenSymbolTableFind(&vm->methodNames, "-", 1))
+  {
+    double value = AS_NUM(writtenConstant(optimizer, 1));
+    writeValue(optimizer, NUM_VAL(-value), unwriteInstructions(optimizer, 1));
+    return true;
+  }
+
+  // A getter called on a field of `this`.
+  if (instruction == CODE_CALL_0 &&
+      fusableInstruction(optimizer, 1, ip) == CODE_LOAD_FIELD_THIS)
+  {
+    int field = optimizer->newCode.data[optimizer->newCode.count - 1];
+    int origin = unwriteInstructions(optimizer, 1);
+
+    startInstruction(optimizer, origin);
+    writeByte(optimizer, CODE_CALL_FIELD_THIS_0, line);
+    writeByte(optimizer, field, line);
+    for (int i = 1; i <= 4; i++) writeByte(optimizer, code[ip + i], line);
+    return true;
+  }
+
+  if (instruction == CODE_CALL_0) return false;
+
+  // An operator on two constants is computed now.
+  if (instruction != CODE_CALL_1 &&
+      fusableInstruction(optimizer, 2, ip) == CODE_CONSTANT &&
+      fusableInstruction(optimizer, 1, ip) == CODE_CONSTANT)
+  {
+    Value result;
+    if (foldOperator(optimizer->compiler, instruction,
+                     writtenConstant(optimizer, 2),
+                     writtenConstant(optimizer, 1), &result))
+    {
+      // The new value isn't reachable by the GC until it's a constant.
+      if (IS_OBJ(result)) wrenPushRoot(vm, AS_OBJ(result));
+      writeValue(optimizer, result, unwriteInstructions(optimizer, 2));
+      if (IS_OBJ(result)) wrenPopRoot(vm);
+      return true;
+    }
+  }
+
+  // A local and a constant passed to a method or operator, like `i + 1`.
+  Code load = fusableInstruction(optimizer, 2, ip);
+  if ((load == CODE_LOAD_LOCAL ||
+       (load >= CODE_LOAD_LOCAL_0 && load <= CODE_LOAD_LOCAL_8)) &&
+      fusableInstruction(optimizer, 1, ip) == CODE_CONSTANT)
+  {
+    const uint8_t* bytes = optimizer->newCode.data +
+        optimizer->starts[optimizer->numWritten - 2];
+    int local = load == CODE_LOAD_LOCAL ? bytes[1] : load - CODE_LOAD_LOCAL_0;
+    bytes = optimizer->newCode.data +
+        optimizer->starts[optimizer->numWritten - 1];
+    int constantHigh = bytes[1];
+    int constantLow = bytes[2];
+    int origin = unwriteInstructions(optimizer, 2);
+
+    startInstruction(optimizer, origin);
+    writeByte(optimizer, CODE_CALL_LOCAL_CONSTANT, line);
+    writeByte(optimizer, local, line);
+    writeByte(optimizer, constantHigh, line);
+    writeByte(optimizer, constantLow, line);
+    writeByte(optimizer, instruction, line);
+    for (int i = 1; i <= 4; i++) writeByte(optimizer, code[ip + i], line);
+    return true;
+  }
+
+  return false;
+}
+
+// Rewrites the bytecode of [compiler]'s finished function to do the same work
+// with fewer instructions:
+//
+// * Operators on number and string constants are computed at compile time.
+// * Common sequences of instructions are fused into superinstructions.
+// * Jumps to jumps go straight to where the last one lands. Jumps to the next
+//   instruction and jumps on constant conditions are removed or made
+//   unconditional, and so is code that can never run.
+//
+// The source line table is rewritten along with the code. A fused instruction
+// gets the line of the call or store it ends with, so errors are reported at
+// the same place as before.
+static void optimizeCode(Compiler* compiler)
+{
+  WrenVM* vm = compiler->parser->vm;
+  ObjFn* fn = compiler->fn;
+  int count = fn->code.count;
+
+  Optimizer optimizer;
+  optimizer.compiler = compiler;
+  optimizer.code = fn->code.data;
+  optimizer.lines = fn->debug->sourceLines.data;
+  optimizer.numWritten = 0;
+  optimizer.numJumps = 0;
+
+  // Every rewrite makes the code shorter or leaves it as long as it was, so
+  // the new code fits in buffers the size of the original.
+  wrenByteBufferInit(&optimizer.newCode);
+  wrenIntBufferInit(&optimizer.newLines);
+  optimizer.newCode.data = ALLOCATE_ARRAY(vm, uint8_t, count);
+  optimizer.newCode.capacity = count;
+  optimizer.newLines.data = ALLOCATE_ARRAY(vm, int, count);
+  optimizer.newLines.capacity = count;
+
+  // The arrays indexed by offset in the original code share one allocation.
+  bool* flags = ALLOCATE_ARRAY(vm, bool, count * 2);
+  optimizer.isReachable = flags;
+  optimizer.isTarget = flags + count;
+
+  int* offsets = ALLOCATE_ARRAY(vm, int, count * 5);
+  optimizer.newOffsets = offsets;
+  optimizer.starts = offsets + count;
+  optimizer.origins = offsets + count * 2;
+  optimizer.jumps = offsets + count * 3;
+  optimizer.jumpTargets = offsets + count * 4;
+
+  // Find the code that can run by following every path from the start. The
+  // paths that still need to be followed are kept in [jumps] for now.
+  const uint8_t* code = optimizer.code;
+  memset(flags, 0, sizeof(bool) * count * 2);
+  optimizer.jumps[optimizer.numJumps++] = 0;
+  while (optimizer.numJumps > 0)
+  {
+    int ip = optimizer.jumps[--optimizer.numJumps];
+    while (!optimizer.isReachable[ip])
+    {
+      optimizer.isReachable[ip] = true;
+
+      Code instruction = (Code)code[ip];
+      if (instruction == CODE_END || instruction == CODE_RETURN) break;
+
+      int target = jumpTarget(code, ip);
+      if (target >= 0)
+      {
+        optimizer.isTarget[target] = true;
+        optimizer.jumps[optimizer.numJumps++] = target;
+        if (instruction == CODE_JUMP || instruction == CODE_LOOP) break;
+      }
+
+      ip += 1 + getByteCountForArguments(code, fn->constants.data, ip);
+    }
+  }
+
+  int ip = 0;
+  while (ip < count)
+  {
+    Code instruction = (Code)code[ip];
+    int next = ip + 1 + getByteCountForArguments(code, fn->constants.data, ip);
+    optimizer.newOffsets[ip] = optimizer.newCode.count;
+
+    // Drop code that can never run, like code after a return that nothing
+    // jumps to.
+    if (!optimizer.isReachable[ip] && instruction != CODE_END)
+    {
+      ip = next;
+      continue;
+    }
+
+    switch (instruction)
+    {
+      case CODE_JUMP:
+      case CODE_JUMP_IF:
+      case CODE_AND:
+      case CODE_OR:
+      {
+        // Forward jumps can't form a cycle, so this always ends. Stop before
+        // the offset gets too large for the jump's operand.
+        int target = jumpTarget(code, ip);
+        while (code[target] == CODE_JUMP &&
+               jumpTarget(code, target) - next < MAX_JUMP)
+        {
+          target = jumpTarget(code, target);
+        }
+
+        // A jump to the next instruction does nothing.
+        if (instruction == CODE_JUMP && target == next) break;
+
+        // A condition that is a constant either always jumps or never does.
+        if (instruction == CODE_JUMP_IF)
+        {
+          Code condition = fusableInstruction(&optimizer, 1, ip);
+          if (condition == CODE_TRUE)
+          {
+            unwriteInstructions(&optimizer, 1);
+            break;
+          }
+
+          if (condition == CODE_FALSE || condition == CODE_NULL)
+          {
+            startInstruction(&optimizer, unwriteInstructions(&optimizer, 1));
+            optimizer.jumps[optimizer.numJumps] = optimizer.newCode.count;
+            optimizer.jumpTargets[optimizer.numJumps++] = target;
+            writeByte(&optimizer, CODE_JUMP, optimizer.lines[ip]);
+            writeByte(&optimizer, 0xff, optimizer.lines[ip]);
+            writeByte(&optimizer, 0xff, optimizer.lines[ip]);
+            break;
+          }
+        }
+
+        optimizer.jumps[optimizer.numJumps] = optimizer.newCode.count;
+        optimizer.jumpTargets[optimizer.numJumps++] = target;
+        copyInstruction(&optimizer, ip, next);
+        break;
+      }
+
+      case CODE_LOOP:
+        optimizer.jumps[optimizer.numJumps] = optimizer.newCode.count;
+        optimizer.jumpTargets[optimizer.numJumps++] = jumpTarget(code, ip);
+        copyInstruction(&optimizer, ip, next);
+        break;
+
+      case CODE_POP:
+      {
+        Code store = fusableInstruction(&optimizer, 1, ip);
+        Code fused = CODE_END;
+        if (store == CODE_STORE_LOCAL) fused = CODE_STORE_LOCAL_POP;
+        if (store == CODE_STORE_FIELD_THIS) fused = CODE_STORE_FIELD_THIS_POP;
+        if (store == CODE_STORE_MODULE_VAR) fused = CODE_STORE_MODULE_VAR_POP;
+
+        if (fused == CODE_END)
+        {
+          copyInstruction(&optimizer, ip, next);
+        }
+        else
+        {
+          // The store and its operand keep their lines.
+          optimizer.newCode.data[optimizer.starts[optimizer.numWritten - 1]] =
+              (uint8_t)fused;
+        }
+        break;
+      }
+
+      case CODE_CALL_0:
+      case CODE_CALL_1:
+      case CODE_ADD:
+      case CODE_SUBTRACT:
+      case CODE_MULTIPLY:
+      case CODE_DIVIDE:
+      case CODE_MODULO:
+      case CODE_LESS:
+      case CODE_GREATER:
+      case CODE_LESS_EQUAL:
+      case CODE_GREATER_EQUAL:
+      case CODE_EQUAL:
+      case CODE_NOT_EQUAL:
+        if (!optimizeCall(&optimizer, instruction, ip))
+        {
+          copyInstruction(&optimizer, ip, next);
+        }
+        break;
+
+      default:
+        copyInstruction(&optimizer, ip, next);
+        break;
+    }
+
+    ip = next;
+  }
+
+  // Point the jumps at where their targets ended up.
+  for (int i = 0; i < optimizer.numJumps; i++)
+  {
+    int jump = optimizer.jumps[i];
+    int target = optimizer.newOffsets[optimizer.jumpTargets[i]];
+    int offset = optimizer.newCode.data[jump] == CODE_LOOP
+        ? jump + 3 - target
+        : target - (jump + 3);
+
+    optimizer.newCode.data[jump + 1] = (offset >> 8) & 0xff;
+    optimizer.newCode.data[jump + 2] = offset & 0xff;
+  }
+
+  wrenByteBufferClear(vm, &fn->code);
+  wrenIntBufferClear(vm, &fn->debug->sourceLines);
+  fn->code = optimizer.newCode;
+  fn->debug->sourceLines = optimizer.newLines;
+
+  DEALLOCATE(vm, flags);
+  DEALLOCATE(vm, offsets);
+}
+
 // Marks the beginning of a loop. Keeps track of the current instruction so we
 // know what to loop back to at the end of the body.
 static void startLoop(Compiler* compiler, Loop* loop)
@@ -3022,6 +3631,37 @@ static void endLoop(Compiler* compiler)
   compiler->loop = compiler->loop->enclosing;
 }
 
+// Compiles the sequence expression of a for loop. If the whole expression is a
+// range literal like `from...to`, only its bounds are compiled and this returns
+// true with [isInclusive] set. Otherwise, compiles the expression like any other
+// and returns false.
+static bool forSequence(Compiler* compiler, bool* isInclusive)
+{
+  // Compile the lower bound like [expression] would, but stop before any
+  // operator that binds less tightly than a range.
+  if (!parsePrefix(compiler, true)) return false;
+  parseInfix(compiler, PREC_TERM, true);
+
+  TokenType type = peek(compiler);
+  if (type == TOKEN_DOTDOT || type == TOKEN_DOTDOTDOT)
+  {
+    nextToken(compiler->parser);
+    ignoreNewlines(compiler);
+    parsePrecedence(compiler, PREC_TERM);
+
+    *isInclusive = type == TOKEN_DOTDOT;
+    if (peek(compiler) == TOKEN_RIGHT_PAREN) return true;
+
+    // The range is only the left operand of a larger expression.
+    const char* name = getRule(type)->name;
+    Signature signature = { name, (int)strlen(name), SIG_METHOD, 1 };
+    callSignature(compiler, CODE_CALL_0, &signature);
+  }
+
+  parseInfix(compiler, PREC_LOWEST, true);
+  return false;
+}
+
 static void forStatement(Compiler* compiler)
 {
   // A for statement like:
@@ -3051,6 +3691,12 @@ static void forStatement(Compiler* compiler)
   //   it should exit the loop.
   // - The .iteratorValue() method is used to get the value at the current
   //   iterator position.
+  //
+  // When the sequence is a range literal like `0...count`, the range isn't
+  // created. Instead, its bounds are kept in two hidden locals and the loop
+  // counts from one to the other using the FOR_RANGE instructions. If the
+  // bounds turn out not to be numbers, those instructions fall back to calling
+  // the range operator, "iterate" and "iteratorValue" like above.
 
   // Create a scope for the hidden local variables used for the iterator.
   pushScope(compiler);
@@ -3068,18 +3714,38 @@ static void forStatement(Compiler* compiler)
   // Evaluate the sequence expression and store it in a hidden local variable.
   // The space in the variable name ensures it won't collide with a user-defined
   // variable.
-  expression(compiler);
+  bool isInclusive = false;
+  bool isRange = forSequence(compiler, &isInclusive);
 
   // Verify that there is space to hidden local variables.
-  // Note that we expect only two addLocal calls next to each other in the
-  // following code.
-  if (compiler->numLocals + 2 > MAX_LOCALS)
+  // Note that we expect only two addLocal calls (three for a range) next to
+  // each other in the following code.
+  int numHidden = isRange ? 3 : 2;
+  if (compiler->numLocals + numHidden > MAX_LOCALS)
   {
     error(compiler, "Cannot declare more than %d variables in one scope. (Not enough space for for-loops internal variables)",
           MAX_LOCALS);
     return;
   }
-  int seqSlot = addLocal(compiler, "seq ", 4);
+
+  int seqSlot;
+  if (isRange)
+  {
+    // Keep the bounds if they are numbers, or replace them with the range and
+    // a null upper bound if they aren't.
+    const char* rangeName = isInclusive ? "..(_)" : "...(_)";
+    int symbol = methodSymbol(compiler, rangeName, (int)strlen(rangeName));
+    emitShortArg(compiler, CODE_FOR_RANGE, symbol);
+    emitCallCache(compiler);
+    null(compiler, false);
+
+    seqSlot = addLocal(compiler, "seq ", 4);
+    addLocal(compiler, "to ", 3);
+  }
+  else
+  {
+    seqSlot = addLocal(compiler, "seq ", 4);
+  }
 
   // Create another hidden local for the iterator object.
   null(compiler, false);
@@ -3091,18 +3757,44 @@ static void forStatement(Compiler* compiler)
   startLoop(compiler, &loop);
 
   // Advance the iterator by calling the ".iterate" method on the sequence.
-  loadLocal(compiler, seqSlot);
-  loadLocal(compiler, iterSlot);
+  if (isRange)
+  {
+    // When falling back, the FOR_RANGE instructions push the sequence and the
+    // iterator themselves to call a method on them.
+    if (compiler->numSlots + 2 > compiler->fn->maxSlots)
+    {
+      compiler->fn->maxSlots = compiler->numSlots + 2;
+    }
+
+    emitByteArg(compiler, CODE_FOR_RANGE_ITERATE, seqSlot);
+    emitByte(compiler, isInclusive);
+    emitShort(compiler, methodSymbol(compiler, "iterate(_)", 10));
+    emitCallCache(compiler);
+  }
+  else
+  {
+    loadLocal(compiler, seqSlot);
+    loadLocal(compiler, iterSlot);
+    callMethod(compiler, 1, "iterate(_)", 10);
+  }
 
   // Update and test the iterator.
-  callMethod(compiler, 1, "iterate(_)", 10);
   emitByteArg(compiler, CODE_STORE_LOCAL, iterSlot);
   testExitLoop(compiler);
 
   // Get the current value in the sequence by calling ".iteratorValue".
-  loadLocal(compiler, seqSlot);
-  loadLocal(compiler, iterSlot);
-  callMethod(compiler, 1, "iteratorValue(_)", 16);
+  if (isRange)
+  {
+    emitByteArg(compiler, CODE_FOR_RANGE_VALUE, seqSlot);
+    emitShort(compiler, methodSymbol(compiler, "iteratorValue(_)", 16));
+    emitCallCache(compiler);
+  }
+  else
+  {
+    loadLocal(compiler, seqSlot);
+    loadLocal(compiler, iterSlot);
+    callMethod(compiler, 1, "iteratorValue(_)", 16);
+  }
 
   // Bind the loop variable in its own scope. This ensures we get a fresh
   // variable each iteration so that closures for it don't all see the same one.
@@ -3289,6 +3981,7 @@ static void createConstructor(Compiler* compiler, Signature* signature,
   // Run its initializer.
   emitShortArg(&methodCompiler, (Code)(CODE_CALL_0 + signature->arity),
                initializerSymbol);
+  emitCallCache(&methodCompiler);
   
   // Return the instance.
   emitOp(&methodCompiler, CODE_RETURN);
@@ -3569,8 +4262,14 @@ static void classDefinition(Compiler* compiler, bool isForeign)
         ? wrenNewMap(compiler->parser->vm) 
         : NULL;
   classInfo.methodAttributes = NULL;
-  // Copy any existing attributes into the class
+  // Copy any existing attributes into the class. The map isn't reachable from
+  // the compiler until the class is, so keep it alive while copying allocates.
+  if (classInfo.classAttributes != NULL)
+  {
+    wrenPushRoot(compiler->parser->vm, (Obj*)classInfo.classAttributes);
+  }
   copyAttributes(compiler, classInfo.classAttributes);
+  if (classInfo.classAttributes != NULL) wrenPopRoot(compiler->parser->vm);
 
   // Set up a symbol table for the class's fields. We'll initially compile
   // them to slots starting at zero. When the method is bound to the class, the
@@ -3852,6 +4551,8 @@ void wrenBindMethodCode(ObjClass* classObj, ObjFn* fn)
       case CODE_STORE_FIELD:
       case CODE_LOAD_FIELD_THIS:
       case CODE_STORE_FIELD_THIS:
+      case CODE_STORE_FIELD_THIS_POP:
+      case CODE_CALL_FIELD_THIS_0:
         // Shift this class's fields down past the inherited ones. We don't
         // check for overflow here because we'll see if the number of fields
         // overflows when the subclass is created.
@@ -3901,6 +4602,29 @@ void wrenBindMethodCode(ObjClass* classObj, ObjFn* fn)
   }
 }
 
+MethodType wrenMethodBodyType(ObjFn* fn, int* field)
+{
+  uint8_t* code = fn->code.data;
+
+  // `name { _field }` compiles to loading the field and returning it.
+  if (code[0] == CODE_LOAD_FIELD_THIS && code[2] == CODE_RETURN)
+  {
+    *field = code[1];
+    return METHOD_FIELD_GETTER;
+  }
+
+  // `name=(value) { _field = value }` stores the argument and returns it. Since
+  // the code starts with it, local 1 can only be the first parameter.
+  if (code[0] == CODE_LOAD_LOCAL_1 && code[1] == CODE_STORE_FIELD_THIS &&
+      code[3] == CODE_RETURN)
+  {
+    *field = code[2];
+    return METHOD_FIELD_SETTER;
+  }
+
+  return METHOD_BLOCK;
+}
+
 void wrenMarkCompiler(WrenVM* vm, Compiler* compiler)
 {
   wrenGrayValue(vm, compiler->parser->current.value);
@@ -3980,6 +4704,7 @@ static void addToAttributeGroup(Compiler* compiler,
 
   //keyItems.add(value)
   ObjList* keyItems = AS_LIST(keyItemsValue);
+  wrenWriteBarrier(vm, (Obj*)keyItems);
   wrenValueBufferWrite(vm, &keyItems->elements, value);
 
   if(IS_OBJ(group)) wrenPopRoot(vm);
@@ -4128,7 +4853,9 @@ static void copyMethodAttributes(Compiler* compiler, bool isForeign,
   
   // Store the method attributes in the class map
   Value key = wrenNewStringLength(vm, fullSignatureWithPrefix, fullLength);
+  wrenPushRoot(vm, AS_OBJ(key));
   wrenMapSet(vm, compiler->enclosingClass->methodAttributes, key, OBJ_VAL(methodAttr));
 
   wrenPopRoot(vm);
+  wrenPopRoot(vm);
 }
@@ -50,6 +50,15 @@ ObjFn* wrenCompile(WrenVM* vm, ObjModule* module, const char* source,
 // method is bound, we walk the bytecode for the function and patch it up.
 void wrenBindMethodCode(ObjClass* classObj, ObjFn* fn);
 
+// Returns METHOD_FIELD_GETTER if the body of method [fn] does nothing but
+// return one of the receiver's fields, or METHOD_FIELD_SETTER if it does
+// nothing but store its first argument in one and return it, and sets [field]
+// to that field. Returns METHOD_BLOCK for any other body.
+//
+// The method has to be bound with [wrenBindMethodCode] first, so that the
+// field is the index in the instance and not only in the method's own class.
+MethodType wrenMethodBodyType(ObjFn* fn, int* field);
+
 // Reaches all of the heap-allocated objects in use by [compiler] (and all of
 // its parents) so that they are not collected by the GC.
 void wrenMarkCompiler(WrenVM* vm, Compiler* compiler);
@@ -321,6 +321,7 @@ DEF_PRIMITIVE(list_new)
 
 DEF_PRIMITIVE(list_add)
 {
+  wrenWriteBarrier(vm, AS_OBJ(args[0]));
   wrenValueBufferWrite(vm, &AS_LIST(args[0])->elements, args[1]);
   RETURN_VAL(args[1]);
 }
@@ -330,6 +331,7 @@ DEF_PRIMITIVE(list_add)
 // minimize stack churn.
 DEF_PRIMITIVE(list_addCore)
 {
+  wrenWriteBarrier(vm, AS_OBJ(args[0]));
   wrenValueBufferWrite(vm, &AS_LIST(args[0])->elements, args[1]);
   
   // Return the list.
@@ -390,6 +392,23 @@ DEF_PRIMITIVE(list_iteratorValue)
   RETURN_VAL(list->elements.data[index]);
 }
 
+// Joins the elements of the list with a separator in a single allocation if
+// they are all strings. Otherwise returns null, and Sequence's join() converts
+// the elements with "toString" first.
+DEF_PRIMITIVE(list_joinCore)
+{
+  if (!validateString(vm, args[1], "Separator")) return false;
+
+  ObjList* list = AS_LIST(args[0]);
+  for (uint32_t i = 0; i < list->elements.count; i++)
+  {
+    if (!IS_STRING(list->elements.data[i])) RETURN_NULL;
+  }
+
+  RETURN_VAL(wrenStringJoin(vm, list->elements.data, list->elements.count,
+                            AS_STRING(args[1])));
+}
+
 DEF_PRIMITIVE(list_removeAt)
 {
   ObjList* list = AS_LIST(args[0]);
@@ -412,6 +431,141 @@ DEF_PRIMITIVE(list_indexOf)
   RETURN_NUM(wrenListIndexOf(vm, list, args[1]));
 }
 
+// Lists with at most this many elements are sorted with an insertion sort.
+// This must match `sort_(_,_,_,_)` in wren_core.wren, so that numbers end up in
+// the same order, even NaNs, whichever of the two sorts them.
+#define SORT_INSERTION_MAX 8
+
+// An element of a list being sorted, along with the key it is ordered by.
+typedef struct
+{
+  Value key;
+  Value value;
+} SortEntry;
+
+// Returns true if [a] sorts before [b]. Keys are either all numbers or all
+// strings, which are ordered by their bytes.
+static inline bool sortLess(Value a, Value b, bool isString)
+{
+  if (!isString) return AS_NUM(a) < AS_NUM(b);
+
+  ObjString* aString = AS_STRING(a);
+  ObjString* bString = AS_STRING(b);
+  uint32_t length = aString->length < bString->length
+      ? aString->length : bString->length;
+  int order = memcmp(aString->value, bString->value, length);
+  return order < 0 || (order == 0 && aString->length < bString->length);
+}
+
+// Stably sorts the [count] [entries] with a merge sort. [scratch] must have
+// room for half of them.
+static void sortEntries(SortEntry* entries, SortEntry* scratch, uint32_t count,
+                        bool isString)
+{
+  if (count <= SORT_INSERTION_MAX)
+  {
+    for (uint32_t i = 1; i < count; i++)
+    {
+      SortEntry entry = entries[i];
+      uint32_t j = i;
+      while (j > 0 && sortLess(entry.key, entries[j - 1].key, isString))
+      {
+        entries[j] = entries[j - 1];
+        j--;
+      }
+      entries[j] = entry;
+    }
+    return;
+  }
+
+  uint32_t half = count / 2;
+  sortEntries(entries, scratch, half, isString);
+  sortEntries(entries + half, scratch, count - half, isString);
+
+  // If the halves are already in order, there is nothing to merge. This makes
+  // sorting an already sorted list linear.
+  if (!sortLess(entries[half].key, entries[half - 1].key, isString)) return;
+
+  memcpy(scratch, entries, sizeof(SortEntry) * half);
+
+  uint32_t left = 0;
+  uint32_t right = half;
+  uint32_t to = 0;
+  while (left < half && right < count)
+  {
+    // Only take from the right half when it is strictly less, so that equal
+    // elements keep their order.
+    if (sortLess(entries[right].key, scratch[left].key, isString))
+    {
+      entries[to++] = entries[right++];
+    }
+    else
+    {
+      entries[to++] = scratch[left++];
+    }
+  }
+
+  while (left < half) entries[to++] = scratch[left++];
+}
+
+// Sorts the elements of [list] by the corresponding elements of [keys], if the
+// keys are all numbers, and Num's operators are the built-in ones, or all
+// strings. Returns false without touching [list] if they are not.
+static bool sortList(WrenVM* vm, ObjList* list, Value* keys)
+{
+  uint32_t count = list->elements.count;
+  if (count < 2) return true;
+
+  bool isString = IS_STRING(keys[0]);
+  if (!isString && !(IS_NUM(keys[0]) && vm->numOperatorsBuiltin)) return false;
+
+  for (uint32_t i = 1; i < count; i++)
+  {
+    if (isString ? !IS_STRING(keys[i]) : !IS_NUM(keys[i])) return false;
+  }
+
+  // The entries are scratch space that is freed before returning, so they are
+  // allocated outside of the garbage collector's accounting, like its own gray
+  // stack.
+  size_t size = sizeof(SortEntry) * (count + count / 2);
+  SortEntry* entries = (SortEntry*)vm->config.reallocateFn(NULL, size,
+      vm->config.userData);
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    entries[i].key = keys[i];
+    entries[i].value = list->elements.data[i];
+  }
+
+  sortEntries(entries, entries + count, count, isString);
+
+  wrenWriteBarrier(vm, (Obj*)list);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    list->elements.data[i] = entries[i].value;
+  }
+
+  vm->config.reallocateFn(entries, 0, vm->config.userData);
+  return true;
+}
+
+DEF_PRIMITIVE(list_sortCore)
+{
+  ObjList* list = AS_LIST(args[0]);
+  RETURN_BOOL(sortList(vm, list, list->elements.data));
+}
+
+DEF_PRIMITIVE(list_sortByCore)
+{
+  ObjList* list = AS_LIST(args[0]);
+  if (!IS_LIST(args[1])) RETURN_FALSE;
+
+  ObjList* keys = AS_LIST(args[1]);
+  if (keys->elements.count != list->elements.count) RETURN_FALSE;
+
+  RETURN_BOOL(sortList(vm, list, keys->elements.data));
+}
+
 DEF_PRIMITIVE(list_swap)
 {
   ObjList* list = AS_LIST(args[0]);
@@ -466,6 +620,7 @@ DEF_PRIMITIVE(list_subscriptSetter)
                                  "Subscript");
   if (index == UINT32_MAX) return false;
 
+  wrenWriteBarrier(vm, (Obj*)list);
   list->elements.data[index] = args[2];
   RETURN_VAL(args[2]);
 }
@@ -595,6 +750,85 @@ DEF_PRIMITIVE(map_valueIteratorValue)
   RETURN_VAL(entry->value);
 }
 
+DEF_PRIMITIVE(weakMap_new)
+{
+  RETURN_OBJ(wrenNewWeakMap(vm));
+}
+
+DEF_PRIMITIVE(weakMap_subscript)
+{
+  if (!validateWeakKey(vm, args[1], "Key")) return false;
+
+  Value value = wrenMapGet(AS_MAP(args[0]), args[1]);
+  if (IS_UNDEFINED(value)) RETURN_NULL;
+
+  RETURN_VAL(value);
+}
+
+DEF_PRIMITIVE(weakMap_subscriptSetter)
+{
+  if (!validateWeakKey(vm, args[1], "Key")) return false;
+
+  wrenMapSet(vm, AS_MAP(args[0]), args[1], args[2]);
+  RETURN_VAL(args[2]);
+}
+
+DEF_PRIMITIVE(weakMap_containsKey)
+{
+  if (!validateWeakKey(vm, args[1], "Key")) return false;
+
+  RETURN_BOOL(!IS_UNDEFINED(wrenMapGet(AS_MAP(args[0]), args[1])));
+}
+
+DEF_PRIMITIVE(weakMap_remove)
+{
+  if (!validateWeakKey(vm, args[1], "Key")) return false;
+
+  RETURN_VAL(wrenMapRemoveKey(vm, AS_MAP(args[0]), args[1]));
+}
+
+// Unlike a map's, an entry of a weak map can disappear between `iterate(_)`
+// and getting its key or value when a collection runs in between. That isn't
+// an error, the entry just reads as null.
+DEF_PRIMITIVE(weakMap_keyIteratorValue)
+{
+  ObjMap* map = AS_MAP(args[0]);
+  uint32_t index = validateIndex(vm, args[1], map->capacity, "Iterator");
+  if (index == UINT32_MAX) return false;
+
+  MapEntry* entry = &map->entries[index];
+  if (IS_UNDEFINED(entry->key)) RETURN_NULL;
+
+  RETURN_VAL(entry->key);
+}
+
+DEF_PRIMITIVE(weakMap_valueIteratorValue)
+{
+  ObjMap* map = AS_MAP(args[0]);
+  uint32_t index = validateIndex(vm, args[1], map->capacity, "Iterator");
+  if (index == UINT32_MAX) return false;
+
+  MapEntry* entry = &map->entries[index];
+  if (IS_UNDEFINED(entry->key)) RETURN_NULL;
+
+  RETURN_VAL(entry->value);
+}
+
+DEF_PRIMITIVE(weakRef_new)
+{
+  if (!validateWeakKey(vm, args[1], "Target")) return false;
+
+  RETURN_OBJ(wrenNewWeakRef(vm, AS_OBJ(args[1])));
+}
+
+DEF_PRIMITIVE(weakRef_target)
+{
+  ObjWeakRef* weakRef = AS_WEAK_REF(args[0]);
+  if (weakRef->target == NULL) RETURN_NULL;
+
+  RETURN_OBJ(weakRef->target);
+}
+
 DEF_PRIMITIVE(null_not)
 {
   RETURN_VAL(TRUE_VAL);
@@ -998,17 +1232,8 @@ DEF_PRIMITIVE(string_fromCodePoint)
 
 DEF_PRIMITIVE(string_fromByte)
 {
-  if (!validateInt(vm, args[1], "Byte")) return false;
-  int byte = (int) AS_NUM(args[1]);
-  if (byte < 0)
-  {
-    RETURN_ERROR("Byte cannot be negative.");
-  }
-  else if (byte > 0xff)
-  {
-    RETURN_ERROR("Byte cannot be greater than 0xff.");
-  }
-  RETURN_VAL(wrenStringFromByte(vm, (uint8_t) byte));
+  if (!validateByte(vm, args[1], "Byte")) return false;
+  RETURN_VAL(wrenStringFromByte(vm, (uint8_t)AS_NUM(args[1])));
 }
 
 DEF_PRIMITIVE(string_byteAt)
@@ -1161,6 +1386,190 @@ DEF_PRIMITIVE(string_startsWith)
   RETURN_BOOL(memcmp(string->value, search->value, search->length) == 0);
 }
 
+DEF_PRIMITIVE(string_replace)
+{
+  if (!IS_STRING(args[1]) || AS_STRING(args[1])->length == 0)
+  {
+    RETURN_ERROR("From must be a non-empty string.");
+  }
+  if (!IS_STRING(args[2])) RETURN_ERROR("To must be a string.");
+
+  RETURN_VAL(wrenStringReplace(vm, AS_STRING(args[0]), AS_STRING(args[1]),
+                               AS_STRING(args[2])));
+}
+
+DEF_PRIMITIVE(string_split)
+{
+  if (!IS_STRING(args[1]) || AS_STRING(args[1])->length == 0)
+  {
+    RETURN_ERROR("Delimiter must be a non-empty string.");
+  }
+
+  ObjString* string = AS_STRING(args[0]);
+  ObjString* delimiter = AS_STRING(args[1]);
+
+  // Count the pieces first so that the list is allocated at its final size.
+  // There is always one more piece than delimiters, even if it's empty.
+  uint32_t count = 1;
+  for (uint32_t index = wrenStringFind(string, delimiter, 0);
+       index != UINT32_MAX;
+       index = wrenStringFind(string, delimiter, index + delimiter->length))
+  {
+    count++;
+  }
+
+  ObjList* list = wrenNewList(vm, count);
+  for (uint32_t i = 0; i < count; i++) list->elements.data[i] = NULL_VAL;
+  wrenPushRoot(vm, (Obj*)list);
+
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t index = i < count - 1
+        ? wrenStringFind(string, delimiter, last)
+        : string->length;
+
+    Value piece = wrenNewStringLength(vm, string->value + last, index - last);
+    wrenWriteBarrier(vm, (Obj*)list);
+    list->elements.data[i] = piece;
+    last = index + delimiter->length;
+  }
+
+  wrenPopRoot(vm);
+  RETURN_OBJ(list);
+}
+
+// Returns the code point that starts at byte [index] of the [length] bytes in
+// [text], or -1 if it isn't a valid UTF-8 sequence or [index] is in the middle
+// of one.
+static int codePointAt(const char* text, uint32_t length, uint32_t index)
+{
+  const uint8_t* bytes = (const uint8_t*)text;
+  if ((bytes[index] & 0xc0) == 0x80) return -1;
+  return wrenUtf8Decode(bytes + index, length - index);
+}
+
+// Returns the index of the first byte of the UTF-8 sequence after the one that
+// starts at [index].
+static uint32_t nextCodePoint(const char* text, uint32_t length, uint32_t index)
+{
+  do
+  {
+    index++;
+  } while (index < length && (text[index] & 0xc0) == 0x80);
+
+  return index;
+}
+
+// Returns true if [codePoint] is one of the code points in the [length] bytes
+// of [chars]. Invalid UTF-8 sequences in [chars] match -1.
+static bool containsCodePoint(const char* chars, uint32_t length,
+                              int codePoint)
+{
+  // ASCII bytes are never part of a longer sequence.
+  if (codePoint >= 0 && codePoint < 0x80)
+  {
+    return memchr(chars, codePoint, length) != NULL;
+  }
+
+  for (uint32_t index = 0; index < length;
+       index = nextCodePoint(chars, length, index))
+  {
+    if (codePointAt(chars, length, index) == codePoint) return true;
+  }
+
+  return false;
+}
+
+// Removes the code points in the [charsLength] bytes of [chars] from the start
+// and/or the end of the string in [args[0]].
+static bool trimString(WrenVM* vm, Value* args, const char* chars,
+                       uint32_t charsLength, bool trimStart, bool trimEnd)
+{
+  ObjString* string = AS_STRING(args[0]);
+  const char* text = string->value;
+  uint32_t length = string->length;
+
+  uint32_t start = 0;
+  if (trimStart)
+  {
+    while (start < length &&
+           containsCodePoint(chars, charsLength,
+                             codePointAt(text, length, start)))
+    {
+      start = nextCodePoint(text, length, start);
+    }
+  }
+
+  uint32_t end = length;
+  if (trimEnd)
+  {
+    // Walk back over the bytes to the start of the last code point that isn't
+    // trimmed, skipping the middles of UTF-8 sequences.
+    uint32_t last = length;
+    while (last > start)
+    {
+      int codePoint = codePointAt(text, length, last - 1);
+      if (codePoint != -1 &&
+          !containsCodePoint(chars, charsLength, codePoint))
+      {
+        break;
+      }
+      last--;
+    }
+
+    end = last == start
+        ? start
+        : last - 1 + wrenUtf8DecodeNumBytes((uint8_t)text[last - 1]);
+  }
+
+  // Strings are immutable, so there's no need to copy an untrimmed one.
+  if (start == 0 && end == length) RETURN_VAL(args[0]);
+
+  RETURN_VAL(wrenNewStringLength(vm, text + start, end - start));
+}
+
+// The characters that trim(), trimEnd() and trimStart() remove by default.
+#define WHITESPACE "\t\r\n "
+
+DEF_PRIMITIVE(string_trim)
+{
+  return trimString(vm, args, WHITESPACE, sizeof(WHITESPACE) - 1, true, true);
+}
+
+DEF_PRIMITIVE(string_trim1)
+{
+  if (!validateString(vm, args[1], "Characters")) return false;
+  ObjString* chars = AS_STRING(args[1]);
+  return trimString(vm, args, chars->value, chars->length, true, true);
+}
+
+DEF_PRIMITIVE(string_trimEnd)
+{
+  return trimString(vm, args, WHITESPACE, sizeof(WHITESPACE) - 1, false, true);
+}
+
+DEF_PRIMITIVE(string_trimEnd1)
+{
+  if (!validateString(vm, args[1], "Characters")) return false;
+  ObjString* chars = AS_STRING(args[1]);
+  return trimString(vm, args, chars->value, chars->length, false, true);
+}
+
+DEF_PRIMITIVE(string_trimStart)
+{
+  return trimString(vm, args, WHITESPACE, sizeof(WHITESPACE) - 1, true, false);
+}
+
+DEF_PRIMITIVE(string_trimStart1)
+{
+  if (!validateString(vm, args[1], "Characters")) return false;
+  ObjString* chars = AS_STRING(args[1]);
+  return trimString(vm, args, chars->value, chars->length, true, false);
+}
+
+#undef WHITESPACE
+
 DEF_PRIMITIVE(string_plus)
 {
   if (!validateString(vm, args[1], "Right operand")) return false;
@@ -1197,6 +1606,85 @@ DEF_PRIMITIVE(string_toString)
   RETURN_VAL(args[0]);
 }
 
+DEF_PRIMITIVE(stringBuilder_new)
+{
+  RETURN_OBJ(wrenNewStringBuilder(vm));
+}
+
+DEF_PRIMITIVE(stringBuilder_add)
+{
+  if (!validateString(vm, args[1], "Value")) return false;
+
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+  ObjString* string = AS_STRING(args[1]);
+  wrenStringBuilderInsert(vm, builder, builder->bytes.count, string->value,
+                          string->length);
+  RETURN_VAL(args[0]);
+}
+
+DEF_PRIMITIVE(stringBuilder_addByte)
+{
+  if (!validateByte(vm, args[1], "Byte")) return false;
+
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+  char byte = (char)(uint8_t)AS_NUM(args[1]);
+  wrenStringBuilderInsert(vm, builder, builder->bytes.count, &byte, 1);
+  RETURN_VAL(args[0]);
+}
+
+DEF_PRIMITIVE(stringBuilder_byteAt)
+{
+  ByteBuffer* bytes = &AS_STRING_BUILDER(args[0])->bytes;
+
+  uint32_t index = validateIndex(vm, args[1], bytes->count, "Index");
+  if (index == UINT32_MAX) return false;
+
+  RETURN_NUM(bytes->data[index]);
+}
+
+DEF_PRIMITIVE(stringBuilder_byteCount)
+{
+  RETURN_NUM(AS_STRING_BUILDER(args[0])->bytes.count);
+}
+
+DEF_PRIMITIVE(stringBuilder_clear)
+{
+  wrenByteBufferClear(vm, &AS_STRING_BUILDER(args[0])->bytes);
+  RETURN_VAL(args[0]);
+}
+
+DEF_PRIMITIVE(stringBuilder_insert)
+{
+  ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+
+  // count + 1 here so you can "insert" at the very end.
+  uint32_t index = validateIndex(vm, args[1], builder->bytes.count + 1,
+                                 "Index");
+  if (index == UINT32_MAX) return false;
+  if (!validateString(vm, args[2], "Value")) return false;
+
+  ObjString* string = AS_STRING(args[2]);
+  wrenStringBuilderInsert(vm, builder, index, string->value, string->length);
+  RETURN_VAL(args[0]);
+}
+
+DEF_PRIMITIVE(stringBuilder_setByteAt)
+{
+  ByteBuffer* bytes = &AS_STRING_BUILDER(args[0])->bytes;
+
+  uint32_t index = validateIndex(vm, args[1], bytes->count, "Index");
+  if (index == UINT32_MAX) return false;
+  if (!validateByte(vm, args[2], "Byte")) return false;
+
+  bytes->data[index] = (uint8_t)AS_NUM(args[2]);
+  RETURN_VAL(args[2]);
+}
+
+DEF_PRIMITIVE(stringBuilder_toString)
+{
+  RETURN_VAL(wrenStringBuilderToString(vm, AS_STRING_BUILDER(args[0])));
+}
+
 DEF_PRIMITIVE(system_clock)
 {
   RETURN_NUM((double)clock() / CLOCKS_PER_SEC);
@@ -1208,6 +1696,14 @@ DEF_PRIMITIVE(system_gc)
   RETURN_NULL;
 }
 
+DEF_PRIMITIVE(system_gcStep)
+{
+  if (!validateNum(vm, args[1], "Budget")) return false;
+
+  // The budget is in milliseconds.
+  RETURN_BOOL(wrenCollectGarbageFor(vm, AS_NUM(args[1]) / 1000.0));
+}
+
 DEF_PRIMITIVE(system_writeString)
 {
   if (vm->config.writeFn != NULL)
@@ -1409,6 +1905,10 @@ void wrenInitializeCore(WrenVM* vm)
   PRIMITIVE(vm->numClass, "==(_)", num_eqeq);
   PRIMITIVE(vm->numClass, "!=(_)", num_bangeq);
 
+  // The operators above are the ones the interpreter computes inline for
+  // numbers. Any method bound on Num from now on turns that off.
+  vm->numOperatorsBuiltin = true;
+
   vm->stringClass = AS_CLASS(wrenFindVariable(vm, coreModule, "String"));
   PRIMITIVE(vm->stringClass->obj.classObj, "fromCodePoint(_)", string_fromCodePoint);
   PRIMITIVE(vm->stringClass->obj.classObj, "fromByte(_)", string_fromByte);
@@ -1425,8 +1925,28 @@ void wrenInitializeCore(WrenVM* vm)
   PRIMITIVE(vm->stringClass, "iterateByte_(_)", string_iterateByte);
   PRIMITIVE(vm->stringClass, "iteratorValue(_)", string_iteratorValue);
   PRIMITIVE(vm->stringClass, "startsWith(_)", string_startsWith);
+  PRIMITIVE(vm->stringClass, "replace(_,_)", string_replace);
+  PRIMITIVE(vm->stringClass, "split(_)", string_split);
+  PRIMITIVE(vm->stringClass, "trim()", string_trim);
+  PRIMITIVE(vm->stringClass, "trim(_)", string_trim1);
+  PRIMITIVE(vm->stringClass, "trimEnd()", string_trimEnd);
+  PRIMITIVE(vm->stringClass, "trimEnd(_)", string_trimEnd1);
+  PRIMITIVE(vm->stringClass, "trimStart()", string_trimStart);
+  PRIMITIVE(vm->stringClass, "trimStart(_)", string_trimStart1);
   PRIMITIVE(vm->stringClass, "toString", string_toString);
 
+  vm->stringBuilderClass = AS_CLASS(wrenFindVariable(vm, coreModule,
+                                                     "StringBuilder"));
+  PRIMITIVE(vm->stringBuilderClass->obj.classObj, "new()", stringBuilder_new);
+  PRIMITIVE(vm->stringBuilderClass, "add(_)", stringBuilder_add);
+  PRIMITIVE(vm->stringBuilderClass, "addByte(_)", stringBuilder_addByte);
+  PRIMITIVE(vm->stringBuilderClass, "byteAt(_)", stringBuilder_byteAt);
+  PRIMITIVE(vm->stringBuilderClass, "byteCount", stringBuilder_byteCount);
+  PRIMITIVE(vm->stringBuilderClass, "clear()", stringBuilder_clear);
+  PRIMITIVE(vm->stringBuilderClass, "insert(_,_)", stringBuilder_insert);
+  PRIMITIVE(vm->stringBuilderClass, "setByteAt(_,_)", stringBuilder_setByteAt);
+  PRIMITIVE(vm->stringBuilderClass, "toString", stringBuilder_toString);
+
   vm->listClass = AS_CLASS(wrenFindVariable(vm, coreModule, "List"));
   PRIMITIVE(vm->listClass->obj.classObj, "filled(_,_)", list_filled);
   PRIMITIVE(vm->listClass->obj.classObj, "new()", list_new);
@@ -1439,9 +1959,12 @@ void wrenInitializeCore(WrenVM* vm)
   PRIMITIVE(vm->listClass, "insert(_,_)", list_insert);
   PRIMITIVE(vm->listClass, "iterate(_)", list_iterate);
   PRIMITIVE(vm->listClass, "iteratorValue(_)", list_iteratorValue);
+  PRIMITIVE(vm->listClass, "joinCore_(_)", list_joinCore);
   PRIMITIVE(vm->listClass, "removeAt(_)", list_removeAt);
   PRIMITIVE(vm->listClass, "remove(_)", list_removeValue);
   PRIMITIVE(vm->listClass, "indexOf(_)", list_indexOf);
+  PRIMITIVE(vm->listClass, "sortCore_()", list_sortCore);
+  PRIMITIVE(vm->listClass, "sortByCore_(_)", list_sortByCore);
   PRIMITIVE(vm->listClass, "swap(_,_)", list_swap);
 
   vm->mapClass = AS_CLASS(wrenFindVariable(vm, coreModule, "Map"));
@@ -1457,6 +1980,23 @@ void wrenInitializeCore(WrenVM* vm)
   PRIMITIVE(vm->mapClass, "keyIteratorValue_(_)", map_keyIteratorValue);
   PRIMITIVE(vm->mapClass, "valueIteratorValue_(_)", map_valueIteratorValue);
 
+  vm->weakMapClass = AS_CLASS(wrenFindVariable(vm, coreModule, "WeakMap"));
+  PRIMITIVE(vm->weakMapClass->obj.classObj, "new()", weakMap_new);
+  PRIMITIVE(vm->weakMapClass, "[_]", weakMap_subscript);
+  PRIMITIVE(vm->weakMapClass, "[_]=(_)", weakMap_subscriptSetter);
+  PRIMITIVE(vm->weakMapClass, "clear()", map_clear);
+  PRIMITIVE(vm->weakMapClass, "containsKey(_)", weakMap_containsKey);
+  PRIMITIVE(vm->weakMapClass, "count", map_count);
+  PRIMITIVE(vm->weakMapClass, "remove(_)", weakMap_remove);
+  PRIMITIVE(vm->weakMapClass, "iterate(_)", map_iterate);
+  PRIMITIVE(vm->weakMapClass, "keyIteratorValue_(_)", weakMap_keyIteratorValue);
+  PRIMITIVE(vm->weakMapClass, "valueIteratorValue_(_)",
+            weakMap_valueIteratorValue);
+
+  vm->weakRefClass = AS_CLASS(wrenFindVariable(vm, coreModule, "WeakRef"));
+  PRIMITIVE(vm->weakRefClass->obj.classObj, "new(_)", weakRef_new);
+  PRIMITIVE(vm->weakRefClass, "target", weakRef_target);
+
   vm->rangeClass = AS_CLASS(wrenFindVariable(vm, coreModule, "Range"));
   PRIMITIVE(vm->rangeClass, "from", range_from);
   PRIMITIVE(vm->rangeClass, "to", range_to);
@@ -1470,6 +2010,7 @@ void wrenInitializeCore(WrenVM* vm)
   ObjClass* systemClass = AS_CLASS(wrenFindVariable(vm, coreModule, "System"));
   PRIMITIVE(systemClass->obj.classObj, "clock", system_clock);
   PRIMITIVE(systemClass->obj.classObj, "gc()", system_gc);
+  PRIMITIVE(systemClass->obj.classObj, "gcStep(_)", system_gcStep);
   PRIMITIVE(systemClass->obj.classObj, "writeString_(_)", system_writeString);
 
   // While bootstrapping the core types and running the core module, a number
@@ -1480,8 +2021,8 @@ void wrenInitializeCore(WrenVM* vm)
   //
   // These all currently have a NULL classObj pointer, so go back and assign
   // them now that the string class is known.
-  for (Obj* obj = vm->first; obj != NULL; obj = obj->next)
+  for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
   {
-    if (obj->type == OBJ_STRING) obj->classObj = vm->stringClass;
+    if (wrenObjType(obj) == OBJ_STRING) obj->classObj = vm->stringClass;
   }
 }
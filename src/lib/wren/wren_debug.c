@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "wren_debug.h"
 
@@ -44,7 +46,7 @@ void wrenDebugPrintStackTrace(WrenVM* vm)
 
 static void dumpObject(Obj* obj)
 {
-  switch (obj->type)
+  switch (wrenObjType(obj))
   {
     case OBJ_CLASS:
       printf("[class %s %p]", ((ObjClass*)obj)->name->value, obj);
@@ -59,8 +61,10 @@ static void dumpObject(Obj* obj)
     case OBJ_MODULE: printf("[module %p]", obj); break;
     case OBJ_RANGE: printf("[range %p]", obj); break;
     case OBJ_STRING: printf("%s", ((ObjString*)obj)->value); break;
+    case OBJ_STRING_BUILDER: printf("[string builder %p]", obj); break;
     case OBJ_UPVALUE: printf("[upvalue %p]", obj); break;
-    default: printf("[unknown object %d]", obj->type); break;
+    case OBJ_WEAK_REF: printf("[weak ref %p]", obj); break;
+    default: printf("[unknown object %d]", wrenObjType(obj)); break;
   }
 }
 
@@ -125,6 +129,16 @@ static int dumpInstruction(WrenVM* vm, ObjFn* fn, int i, int* lastLine)
       printf("%-16s %5d\n", name, READ_BYTE());                                \
       break
 
+  // Operators are followed by the method symbol and the inline cache index.
+  #define OPERATOR_INSTRUCTION(name)                                           \
+      {                                                                        \
+        int symbol = READ_SHORT();                                             \
+        int cache = READ_SHORT();                                              \
+        printf("%-16s %5d '%s' %5d\n", name, symbol,                           \
+               vm->methodNames.data[symbol]->value, cache);                    \
+        break;                                                                 \
+      }
+
   switch (code)
   {
     case CODE_CONSTANT:
@@ -198,8 +212,9 @@ static int dumpInstruction(WrenVM* vm, ObjFn* fn, int i, int* lastLine)
     {
       int numArgs = bytecode[i - 1] - CODE_CALL_0;
       int symbol = READ_SHORT();
-      printf("CALL_%-11d %5d '%s'\n", numArgs, symbol,
-             vm->methodNames.data[symbol]->value);
+      int cache = READ_SHORT();
+      printf("CALL_%-11d %5d '%s' %5d\n", numArgs, symbol,
+             vm->methodNames.data[symbol]->value, cache);
       break;
     }
 
@@ -224,8 +239,85 @@ static int dumpInstruction(WrenVM* vm, ObjFn* fn, int i, int* lastLine)
       int numArgs = bytecode[i - 1] - CODE_SUPER_0;
       int symbol = READ_SHORT();
       int superclass = READ_SHORT();
-      printf("SUPER_%-10d %5d '%s' %5d\n", numArgs, symbol,
-             vm->methodNames.data[symbol]->value, superclass);
+      int cache = READ_SHORT();
+      printf("SUPER_%-10d %5d '%s' %5d %5d\n", numArgs, symbol,
+             vm->methodNames.data[symbol]->value, superclass, cache);
+      break;
+    }
+
+    case CODE_ADD: OPERATOR_INSTRUCTION("ADD");
+    case CODE_SUBTRACT: OPERATOR_INSTRUCTION("SUBTRACT");
+    case CODE_MULTIPLY: OPERATOR_INSTRUCTION("MULTIPLY");
+    case CODE_DIVIDE: OPERATOR_INSTRUCTION("DIVIDE");
+    case CODE_MODULO: OPERATOR_INSTRUCTION("MODULO");
+    case CODE_LESS: OPERATOR_INSTRUCTION("LESS");
+    case CODE_GREATER: OPERATOR_INSTRUCTION("GREATER");
+    case CODE_LESS_EQUAL: OPERATOR_INSTRUCTION("LESS_EQUAL");
+    case CODE_GREATER_EQUAL: OPERATOR_INSTRUCTION("GREATER_EQUAL");
+    case CODE_EQUAL: OPERATOR_INSTRUCTION("EQUAL");
+    case CODE_NOT_EQUAL: OPERATOR_INSTRUCTION("NOT_EQUAL");
+
+    case CODE_FOR_RANGE: OPERATOR_INSTRUCTION("FOR_RANGE");
+
+    case CODE_FOR_RANGE_ITERATE:
+    {
+      int slot = READ_BYTE();
+      int isInclusive = READ_BYTE();
+      int symbol = READ_SHORT();
+      int cache = READ_SHORT();
+      printf("%-16s %5d %d '%s' %5d\n", "FOR_RANGE_ITERATE", slot, isInclusive,
+             vm->methodNames.data[symbol]->value, cache);
+      break;
+    }
+
+    case CODE_FOR_RANGE_VALUE:
+    {
+      int slot = READ_BYTE();
+      int symbol = READ_SHORT();
+      int cache = READ_SHORT();
+      printf("%-16s %5d '%s' %5d\n", "FOR_RANGE_VALUE", slot,
+             vm->methodNames.data[symbol]->value, cache);
+      break;
+    }
+
+    case CODE_TO_STRING: OPERATOR_INSTRUCTION("TO_STRING");
+
+    case CODE_INTERPOLATE:
+      printf("%-16s %5d\n", "INTERPOLATE", READ_SHORT());
+      break;
+
+    case CODE_STORE_LOCAL_POP: BYTE_INSTRUCTION("STORE_LOCAL_POP");
+    case CODE_STORE_FIELD_THIS_POP: BYTE_INSTRUCTION("STORE_FIELD_THIS_POP");
+
+    case CODE_STORE_MODULE_VAR_POP:
+    {
+      int slot = READ_SHORT();
+      printf("%-16s %5d '%s'\n", "STORE_MODULE_VAR_POP", slot,
+             fn->module->variableNames.data[slot]->value);
+      break;
+    }
+
+    case CODE_CALL_FIELD_THIS_0:
+    {
+      int field = READ_BYTE();
+      int symbol = READ_SHORT();
+      int cache = READ_SHORT();
+      printf("%-16s %5d '%s' %5d\n", "CALL_FIELD_THIS_0", field,
+             vm->methodNames.data[symbol]->value, cache);
+      break;
+    }
+
+    case CODE_CALL_LOCAL_CONSTANT:
+    {
+      int slot = READ_BYTE();
+      int constant = READ_SHORT();
+      // The call instruction is implied by the method's symbol.
+      i++;
+      int symbol = READ_SHORT();
+      int cache = READ_SHORT();
+      printf("%-16s %5d %5d '", "CALL_LOCAL_CONSTANT", slot, constant);
+      wrenDumpValue(fn->constants.data[constant]);
+      printf("' '%s' %5d\n", vm->methodNames.data[symbol]->value, cache);
       break;
     }
 
@@ -351,6 +443,7 @@ static int dumpInstruction(WrenVM* vm, ObjFn* fn, int i, int* lastLine)
 
   #undef READ_BYTE
   #undef READ_SHORT
+  #undef OPERATOR_INSTRUCTION
 }
 
 int wrenDumpInstruction(WrenVM* vm, ObjFn* fn, int i)
@@ -386,3 +479,464 @@ void wrenDumpStack(ObjFiber* fiber)
   }
   printf("\n");
 }
+
+static const char* objTypeName(ObjType type)
+{
+  switch (type)
+  {
+    case OBJ_CLASS: return "Class";
+    case OBJ_CLOSURE: return "Closure";
+    case OBJ_FIBER: return "Fiber";
+    case OBJ_FN: return "Fn";
+    case OBJ_FOREIGN: return "Foreign";
+    case OBJ_INSTANCE: return "Instance";
+    case OBJ_LIST: return "List";
+    case OBJ_MAP: return "Map";
+    case OBJ_MODULE: return "Module";
+    case OBJ_RANGE: return "Range";
+    case OBJ_STRING: return "String";
+    case OBJ_STRING_BUILDER: return "StringBuilder";
+    case OBJ_UPVALUE: return "Upvalue";
+    case OBJ_WEAK_REF: return "WeakRef";
+  }
+
+  UNREACHABLE();
+  return NULL;
+}
+
+static int compareCensusClasses(const void* a, const void* b)
+{
+  uintptr_t classA = (uintptr_t)((const HeapCensusEntry*)a)->classObj;
+  uintptr_t classB = (uintptr_t)((const HeapCensusEntry*)b)->classObj;
+  return (classA > classB) - (classA < classB);
+}
+
+static int compareCensusBytes(const void* a, const void* b)
+{
+  uint64_t bytesA = ((const HeapCensusEntry*)a)->bytes;
+  uint64_t bytesB = ((const HeapCensusEntry*)b)->bytes;
+  return (bytesA < bytesB) - (bytesA > bytesB);
+}
+
+int wrenHeapCensus(WrenVM* vm, bool byClass, HeapCensusEntry** entries)
+{
+  int count = OBJ_WEAK_REF + 1;
+  if (byClass)
+  {
+    count = 0;
+    for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+    {
+      if (wrenObjType(obj) == OBJ_CLASS) count++;
+    }
+  }
+
+  *entries = (HeapCensusEntry*)vm->config.reallocateFn(NULL,
+      sizeof(HeapCensusEntry) * (count > 0 ? count : 1), vm->config.userData);
+  memset(*entries, 0, sizeof(HeapCensusEntry) * (count > 0 ? count : 1));
+
+  if (!byClass)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      snprintf((*entries)[i].name, sizeof((*entries)[i].name), "%s",
+               objTypeName((ObjType)i));
+    }
+
+    for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+    {
+      (*entries)[wrenObjType(obj)].count++;
+      (*entries)[wrenObjType(obj)].bytes += wrenObjectSize(obj);
+    }
+  }
+  else
+  {
+    // Sort the classes by address so that each object's class can be found
+    // with a binary search.
+    int i = 0;
+    for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+    {
+      if (wrenObjType(obj) == OBJ_CLASS)
+      {
+        (*entries)[i++].classObj = (ObjClass*)obj;
+      }
+    }
+    qsort(*entries, count, sizeof(HeapCensusEntry), compareCensusClasses);
+
+    for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+    {
+      // Functions and upvalues don't have a class.
+      if (obj->classObj == NULL) continue;
+
+      HeapCensusEntry key;
+      key.classObj = obj->classObj;
+      HeapCensusEntry* entry = (HeapCensusEntry*)bsearch(&key, *entries, count,
+          sizeof(HeapCensusEntry), compareCensusClasses);
+      if (entry == NULL) continue;
+
+      entry->count++;
+      entry->bytes += wrenObjectSize(obj);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+      HeapCensusEntry* entry = &(*entries)[i];
+      ObjString* name = entry->classObj->name;
+      snprintf(entry->name, sizeof(entry->name), "%s",
+               name != NULL ? name->value : "(anonymous)");
+    }
+  }
+
+  // Drop the kinds that have no objects.
+  int used = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if ((*entries)[i].count > 0) (*entries)[used++] = (*entries)[i];
+  }
+
+  qsort(*entries, used, sizeof(HeapCensusEntry), compareCensusBytes);
+  return used;
+}
+
+#if WREN_DEBUG_COUNT_EXECUTION
+
+const char* wrenOpcodeName(Code code)
+{
+  static const char* names[] = {
+    #define OPCODE(name, _) #name,
+    #include "wren_opcodes.h"
+    #undef OPCODE
+  };
+
+  return names[code];
+}
+
+static int compareExecutionCounts(const void* a, const void* b)
+{
+  uint64_t countA = ((const ExecutionCount*)a)->count;
+  uint64_t countB = ((const ExecutionCount*)b)->count;
+  return (countA < countB) - (countA > countB);
+}
+
+// Allocates an array for [count] entries through the VM's reallocateFn. This
+// memory isn't tracked by the GC, so filling it can't trigger a collection.
+static ExecutionCount* newCounts(WrenVM* vm, int count)
+{
+  return (ExecutionCount*)vm->config.reallocateFn(NULL,
+      sizeof(ExecutionCount) * (count > 0 ? count : 1), vm->config.userData);
+}
+
+int wrenFunctionExecutionCounts(WrenVM* vm, ExecutionCount** counts)
+{
+  int count = 0;
+  for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+  {
+    if (wrenObjType(obj) == OBJ_FN && ((ObjFn*)obj)->executionCount > 0)
+    {
+      count++;
+    }
+  }
+
+  *counts = newCounts(vm, count);
+  int i = 0;
+  for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+  {
+    if (wrenObjType(obj) != OBJ_FN) continue;
+    ObjFn* fn = (ObjFn*)obj;
+    if (fn->executionCount == 0) continue;
+
+    // Functions are named after the line they start on since names like
+    // "new(_)" are shared by many of them.
+    int line = fn->debug->sourceLines.count > 0
+        ? fn->debug->sourceLines.data[0] : 0;
+    snprintf((*counts)[i].name, sizeof((*counts)[i].name), "%s (%s:%d)",
+             fn->debug->name,
+             fn->module == NULL || fn->module->name == NULL
+                 ? "<core>" : fn->module->name->value,
+             line);
+    (*counts)[i].count = fn->executionCount;
+    i++;
+  }
+
+  qsort(*counts, count, sizeof(ExecutionCount), compareExecutionCounts);
+  return count;
+}
+
+static void dumpCounts(const char* title, ExecutionCount* counts, int count)
+{
+  qsort(counts, count, sizeof(ExecutionCount), compareExecutionCounts);
+
+  printf("-- %s --\n", title);
+  for (int i = 0; i < count; i++)
+  {
+    printf("%12llu  %s\n", (unsigned long long)counts[i].count, counts[i].name);
+  }
+  printf("\n");
+}
+
+void wrenDumpExecutionCounts(WrenVM* vm)
+{
+  ExecutionCount* counts = newCounts(vm, CODE_END + 1);
+  int count = 0;
+  for (int i = 0; i <= CODE_END; i++)
+  {
+    if (vm->opcodeCounts[i] == 0) continue;
+    snprintf(counts[count].name, sizeof(counts[count].name), "%s",
+             wrenOpcodeName((Code)i));
+    counts[count++].count = vm->opcodeCounts[i];
+  }
+  dumpCounts("opcodes", counts, count);
+  vm->config.reallocateFn(counts, 0, vm->config.userData);
+
+  count = wrenFunctionExecutionCounts(vm, &counts);
+  dumpCounts("functions", counts, count);
+  vm->config.reallocateFn(counts, 0, vm->config.userData);
+
+  counts = newCounts(vm, vm->callCountsCapacity);
+  count = 0;
+  for (int i = 0; i < vm->callCountsCapacity; i++)
+  {
+    if (vm->callCounts[i] == 0) continue;
+    snprintf(counts[count].name, sizeof(counts[count].name), "%s",
+             vm->methodNames.data[i]->value);
+    counts[count++].count = vm->callCounts[i];
+  }
+  dumpCounts("calls", counts, count);
+  vm->config.reallocateFn(counts, 0, vm->config.userData);
+}
+
+void wrenResetExecutionCounts(WrenVM* vm)
+{
+  memset(vm->opcodeCounts, 0, sizeof(vm->opcodeCounts));
+  memset(vm->callCounts, 0, sizeof(uint64_t) * vm->callCountsCapacity);
+  for (Obj* obj = vm->first; obj != NULL; obj = wrenObjNext(obj))
+  {
+    if (wrenObjType(obj) == OBJ_FN) ((ObjFn*)obj)->executionCount = 0;
+  }
+}
+
+#endif
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+
+// Finds the innermost frame running Wren code outside of the core module, so
+// that allocations made by core methods like List.map are attributed to their
+// caller. Returns NULL if there is none.
+static ObjFn* findAllocationSite(WrenVM* vm, int* line)
+{
+  if (vm->compiler != NULL) return NULL;
+
+  for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller)
+  {
+    for (int i = fiber->numFrames - 1; i >= 0; i--)
+    {
+      CallFrame* frame = &fiber->frames[i];
+      ObjFn* fn = frame->closure->fn;
+      if (fn->module == NULL || fn->module->name == NULL) continue;
+
+      // The stubs the compiler generates for constructors have no name, the
+      // interesting site is the code calling them.
+      if (fn->debug->name == NULL || fn->debug->name[0] == '\0') continue;
+
+      // -1 because IP has advanced past the instruction that it just executed.
+      *line = frame->ip > fn->code.data
+          ? fn->debug->sourceLines.data[frame->ip - fn->code.data - 1] : 0;
+      return fn;
+    }
+  }
+
+  return NULL;
+}
+
+// Marks the kind key of buffers, which can't collide with an ObjType or class.
+static const char bufferKind = 0;
+
+static uint32_t hashSite(ObjFn* fn, int line, const void* kind)
+{
+  uintptr_t hash = (uintptr_t)fn ^ ((uintptr_t)kind >> 3) ^ (uintptr_t)line;
+  hash *= 2654435761u;
+  return (uint32_t)(hash ^ (hash >> 16));
+}
+
+static AllocationSite* findSite(AllocationSite* sites, int capacity, ObjFn* fn,
+                                int line, const void* kind)
+{
+  uint32_t index = hashSite(fn, line, kind) & (capacity - 1);
+  for (;;)
+  {
+    AllocationSite* site = &sites[index];
+    if (site->kind == NULL) return site;
+    if (site->fn == fn && site->line == line && site->kind == kind) return site;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growAllocationTable(WrenVM* vm, AllocationTable* table)
+{
+  int capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+  AllocationSite* sites = (AllocationSite*)vm->config.reallocateFn(NULL,
+      sizeof(AllocationSite) * capacity, vm->config.userData);
+  memset(sites, 0, sizeof(AllocationSite) * capacity);
+
+  for (int i = 0; i < table->capacity; i++)
+  {
+    AllocationSite* old = &table->sites[i];
+    if (old->kind == NULL) continue;
+    *findSite(sites, capacity, old->fn, old->line, old->kind) = *old;
+  }
+
+  vm->config.reallocateFn(table->sites, 0, vm->config.userData);
+  table->sites = sites;
+  table->capacity = capacity;
+}
+
+static void addAllocation(WrenVM* vm, AllocationTable* table, ObjFn* fn,
+                          int line, Obj* obj, int count, int64_t bytes)
+{
+  const void* kind = &bufferKind;
+  if (obj != NULL)
+  {
+    // Instances and foreign objects are more useful grouped by class.
+    ObjType type = wrenObjType(obj);
+    kind = (type == OBJ_INSTANCE || type == OBJ_FOREIGN)
+        ? (const void*)obj->classObj : (const void*)(uintptr_t)(type + 1);
+  }
+
+  if (table->count + 1 > table->capacity * 3 / 4) growAllocationTable(vm, table);
+
+  AllocationSite* site = findSite(table->sites, table->capacity, fn, line,
+                                  kind);
+  if (site->kind == NULL)
+  {
+    site->fn = fn;
+    site->line = line;
+    site->kind = kind;
+
+    if (fn == NULL)
+    {
+      snprintf(site->site, sizeof(site->site), "%s",
+               vm->compiler != NULL ? "(compiler)" : "(host)");
+    }
+    else
+    {
+      snprintf(site->site, sizeof(site->site), "%s (%s:%d)", fn->debug->name,
+               fn->module->name->value, line);
+    }
+
+    if (obj == NULL)
+    {
+      snprintf(site->kindName, sizeof(site->kindName), "(buffer)");
+    }
+    else if (kind == (const void*)obj->classObj && obj->classObj != NULL &&
+             obj->classObj->name != NULL)
+    {
+      snprintf(site->kindName, sizeof(site->kindName), "%s",
+               obj->classObj->name->value);
+    }
+    else
+    {
+      snprintf(site->kindName, sizeof(site->kindName), "%s",
+               objTypeName(wrenObjType(obj)));
+    }
+
+    table->count++;
+  }
+
+  site->count += count;
+  site->bytes += bytes;
+}
+
+void wrenTrackAllocation(WrenVM* vm, Obj* obj, size_t bytes)
+{
+  int line = 0;
+  ObjFn* fn = findAllocationSite(vm, &line);
+
+  AllocationTable* tables[] = { &vm->allocations, &vm->frameAllocations };
+  for (int i = 0; i < 2; i++)
+  {
+    if (obj == NULL)
+    {
+      addAllocation(vm, tables[i], fn, line, NULL, 0, (int64_t)bytes);
+    }
+    else
+    {
+      // Move the object's memory from the buffer it was counted as.
+      addAllocation(vm, tables[i], fn, line, NULL, 0, -(int64_t)bytes);
+      addAllocation(vm, tables[i], fn, line, obj, 1, (int64_t)bytes);
+    }
+  }
+
+  if (obj != NULL) vm->lastAllocationSize = 0;
+}
+
+static int compareAllocationSites(const void* a, const void* b)
+{
+  int64_t bytesA = ((const AllocationSite*)a)->bytes;
+  int64_t bytesB = ((const AllocationSite*)b)->bytes;
+  return (bytesA < bytesB) - (bytesA > bytesB);
+}
+
+int wrenSortedAllocations(WrenVM* vm, bool frame, AllocationSite** sites)
+{
+  AllocationTable* table = frame ? &vm->frameAllocations : &vm->allocations;
+
+  *sites = (AllocationSite*)vm->config.reallocateFn(NULL,
+      sizeof(AllocationSite) * (table->count > 0 ? table->count : 1),
+      vm->config.userData);
+
+  int count = 0;
+  for (int i = 0; i < table->capacity; i++)
+  {
+    AllocationSite* site = &table->sites[i];
+    // Skip buffers that turned out to all be objects.
+    if (site->kind == NULL || (site->count == 0 && site->bytes == 0)) continue;
+    (*sites)[count++] = *site;
+  }
+
+  qsort(*sites, count, sizeof(AllocationSite), compareAllocationSites);
+  return count;
+}
+
+void wrenDumpAllocations(WrenVM* vm, FILE* file, bool frame, int limit)
+{
+  AllocationSite* sites;
+  int count = wrenSortedAllocations(vm, frame, &sites);
+
+  int64_t totalBytes = 0;
+  uint64_t totalCount = 0;
+  for (int i = 0; i < count; i++)
+  {
+    totalBytes += sites[i].bytes;
+    totalCount += sites[i].count;
+  }
+
+  fprintf(file, "%lld bytes in %llu objects\n", (long long)totalBytes,
+          (unsigned long long)totalCount);
+  for (int i = 0; i < count && i < limit; i++)
+  {
+    fprintf(file, "%12lld %10llu  %-16s %s\n", (long long)sites[i].bytes,
+            (unsigned long long)sites[i].count, sites[i].kindName,
+            sites[i].site);
+  }
+
+  vm->config.reallocateFn(sites, 0, vm->config.userData);
+}
+
+void wrenResetFrameAllocations(WrenVM* vm)
+{
+  AllocationTable* table = &vm->frameAllocations;
+  if (table->sites != NULL)
+  {
+    memset(table->sites, 0, sizeof(AllocationSite) * table->capacity);
+  }
+  table->count = 0;
+}
+
+void wrenFreeAllocations(WrenVM* vm)
+{
+  vm->config.reallocateFn(vm->allocations.sites, 0, vm->config.userData);
+  vm->config.reallocateFn(vm->frameAllocations.sites, 0, vm->config.userData);
+  vm->allocations.sites = NULL;
+  vm->frameAllocations.sites = NULL;
+}
+
+#endif
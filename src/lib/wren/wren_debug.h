@@ -1,6 +1,8 @@
 #ifndef wren_debug_h
 #define wren_debug_h
 
+#include <stdio.h>
+
 #include "wren_value.h"
 #include "wren_vm.h"
 
@@ -24,4 +26,74 @@ void wrenDumpCode(WrenVM* vm, ObjFn* fn);
 // Prints the contents of the current stack for [fiber] to stdout.
 void wrenDumpStack(ObjFiber* fiber);
 
+// The number of live objects and the bytes they own for one ObjType or class.
+typedef struct
+{
+  // NULL when counting by ObjType.
+  ObjClass* classObj;
+  char name[64];
+
+  uint64_t count;
+  uint64_t bytes;
+} HeapCensusEntry;
+
+// Counts every object on the heap, by ObjType or, if [byClass] is true, by the
+// class of the object. Stores the totals that aren't empty in a new array in
+// [entries], most bytes first, and returns its length. The array is allocated
+// with the VM's reallocateFn and must be freed by the caller.
+//
+// This includes garbage that hasn't been collected yet, so collect first to
+// only count reachable objects.
+int wrenHeapCensus(WrenVM* vm, bool byClass, HeapCensusEntry** entries);
+
+#if WREN_DEBUG_COUNT_EXECUTION
+
+// The number of times something was executed, with a label for it.
+typedef struct
+{
+  char name[128];
+  uint64_t count;
+} ExecutionCount;
+
+// Returns the name of [code], like "CALL_1".
+const char* wrenOpcodeName(Code code);
+
+// Stores the instruction counts of every function that has run in a new array
+// in [counts], most executed first, and returns its length. The array is
+// allocated with the VM's reallocateFn and must be freed by the caller.
+int wrenFunctionExecutionCounts(WrenVM* vm, ExecutionCount** counts);
+
+// Prints the instruction counts per opcode and per function, and the call
+// counts per method symbol to stdout, most frequent first.
+void wrenDumpExecutionCounts(WrenVM* vm);
+
+// Resets all of the counts above to zero.
+void wrenResetExecutionCounts(WrenVM* vm);
+
+#endif
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+
+// Records an allocation of [bytes] made by the current Wren function. If [obj]
+// is NULL the memory is a buffer, otherwise [obj] has just been initialized in
+// the [bytes] most recently counted as a buffer.
+void wrenTrackAllocation(WrenVM* vm, Obj* obj, size_t bytes);
+
+// Stores a copy of the allocation sites since the VM started, or since the last
+// wrenResetFrameAllocations() if [frame] is true, in a new array in [sites],
+// most bytes first, and returns its length. The array is allocated with the
+// VM's reallocateFn and must be freed by the caller.
+int wrenSortedAllocations(WrenVM* vm, bool frame, AllocationSite** sites);
+
+// Writes at most [limit] of the sites above to [file], most bytes first.
+void wrenDumpAllocations(WrenVM* vm, FILE* file, bool frame, int limit);
+
+// Starts a new frame of allocations.
+void wrenResetFrameAllocations(WrenVM* vm);
+
+// Frees the allocation tables.
+void wrenFreeAllocations(WrenVM* vm);
+
+#endif
+
 #endif
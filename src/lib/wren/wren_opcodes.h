@@ -78,7 +78,8 @@ OPCODE(STORE_FIELD, -1)
 OPCODE(POP, -1)
 
 // Invoke the method with symbol [arg]. The number indicates the number of
-// arguments (not including the receiver).
+// arguments (not including the receiver). A second argument is the index of
+// the call's inline cache in the function.
 OPCODE(CALL_0, 0)
 OPCODE(CALL_1, -1)
 OPCODE(CALL_2, -2)
@@ -98,7 +99,8 @@ OPCODE(CALL_15, -15)
 OPCODE(CALL_16, -16)
 
 // Invoke a superclass method with symbol [arg]. The number indicates the
-// number of arguments (not including the receiver).
+// number of arguments (not including the receiver). It is followed by the
+// constant holding the superclass and the index of the call's inline cache.
 OPCODE(SUPER_0, 0)
 OPCODE(SUPER_1, -1)
 OPCODE(SUPER_2, -2)
@@ -117,6 +119,81 @@ OPCODE(SUPER_14, -14)
 OPCODE(SUPER_15, -15)
 OPCODE(SUPER_16, -16)
 
+// Invoke an infix operator method with symbol [arg] on the two values on top of
+// the stack. A second argument is the index of the call's inline cache, like
+// CALL_1. When both operands are numbers and Num's operators are the built-in
+// ones, the result is computed inline instead of calling the method.
+OPCODE(ADD, -1)
+OPCODE(SUBTRACT, -1)
+OPCODE(MULTIPLY, -1)
+OPCODE(DIVIDE, -1)
+OPCODE(MODULO, -1)
+OPCODE(LESS, -1)
+OPCODE(GREATER, -1)
+OPCODE(LESS_EQUAL, -1)
+OPCODE(GREATER_EQUAL, -1)
+OPCODE(EQUAL, -1)
+OPCODE(NOT_EQUAL, -1)
+
+// Starts a for loop over a range literal whose bounds are on top of the stack.
+// Takes the symbol of the range operator and an inline cache index like
+// CALL_1. If both bounds are numbers and Num's operators are the built-in ones,
+// the bounds are left on the stack and the NULL the compiler always emits next
+// is skipped. Otherwise, this calls the range operator and the NULL becomes the
+// upper bound, which tells the other FOR_RANGE instructions to fall back.
+OPCODE(FOR_RANGE, -1)
+
+// Pushes the next iterator of a for loop over a range literal. Takes the slot
+// of the first of the loop's hidden locals, which hold the lower bound, upper
+// bound and iterator, then whether the range is inclusive, and the symbol and
+// inline cache index for "iterate(_)", which is called on the range instead if
+// the bounds are not numbers.
+OPCODE(FOR_RANGE_ITERATE, 1)
+
+// Pushes the value of the current iterator of a for loop over a range literal.
+// Takes the slot of the loop's first hidden local and the symbol and inline
+// cache index for "iteratorValue(_)", like FOR_RANGE_ITERATE.
+OPCODE(FOR_RANGE_VALUE, 1)
+
+// Converts the value on top of the stack to a string for an interpolation.
+// Takes the symbol and inline cache index of "toString", which is called
+// unless the value is already a string or is a number that Num's built-in
+// methods can format.
+OPCODE(TO_STRING, 0)
+
+// Joins the [arg] strings on top of the stack into a single string, which
+// replaces them. Used for string interpolation, so the result is allocated
+// once instead of once per part. The compiler accounts for the parts it pops.
+OPCODE(INTERPOLATE, 0)
+
+// The superinstructions below are never emitted while parsing. The optimizer
+// fuses common sequences of instructions into them once a function has been
+// compiled.
+
+// Stores the top of stack in local slot [arg] and pops it. Same as STORE_LOCAL
+// followed by POP.
+OPCODE(STORE_LOCAL_POP, -1)
+
+// Stores the top of stack in field slot [arg] of the receiver and pops it.
+// Same as STORE_FIELD_THIS followed by POP.
+OPCODE(STORE_FIELD_THIS_POP, -1)
+
+// Stores the top of stack in top-level variable slot [arg] and pops it. Same
+// as STORE_MODULE_VAR followed by POP.
+OPCODE(STORE_MODULE_VAR_POP, -1)
+
+// Calls a method with no arguments on the value of field slot [arg] of the
+// receiver. Takes the field, then the symbol and inline cache index of the
+// method. Same as LOAD_FIELD_THIS followed by CALL_0.
+OPCODE(CALL_FIELD_THIS_0, 1)
+
+// Calls a method with one argument on a local variable, passing a constant.
+// Takes the local's slot, the constant's index, the call instruction, which is
+// CALL_1 or one of the infix operators, and then its symbol and inline cache
+// index. Operators on numbers are computed inline like ADD and friends. Same
+// as loading the local and the constant followed by the call.
+OPCODE(CALL_LOCAL_CONSTANT, 1)
+
 // Jump the instruction pointer [arg] forward.
 OPCODE(JUMP, 0)
 
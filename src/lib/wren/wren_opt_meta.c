@@ -4,6 +4,7 @@
 
 #include <string.h>
 
+#include "wren_debug.h"
 #include "wren_vm.h"
 #include "wren_opt_meta.wren.inc"
 
@@ -65,6 +66,214 @@ void metaGetModuleVariables(WrenVM* vm)
   }
 }
 
+// Returns a map with the execution counts keyed by "opcodes", "functions" and
+// "calls", or null if the VM wasn't built with WREN_DEBUG_COUNT_EXECUTION.
+void metaExecutionCounts(WrenVM* vm)
+{
+#if WREN_DEBUG_COUNT_EXECUTION
+  wrenEnsureSlots(vm, 4);
+  wrenSetSlotNewMap(vm, 0);
+
+  wrenSetSlotNewMap(vm, 1);
+  for (int i = 0; i <= CODE_END; i++)
+  {
+    if (vm->opcodeCounts[i] == 0) continue;
+    wrenSetSlotString(vm, 2, wrenOpcodeName((Code)i));
+    wrenSetSlotDouble(vm, 3, (double)vm->opcodeCounts[i]);
+    wrenSetMapValue(vm, 1, 2, 3);
+  }
+  wrenSetSlotString(vm, 2, "opcodes");
+  wrenSetMapValue(vm, 0, 2, 1);
+
+  // Functions may be collected while the map is being filled in, so copy
+  // their counts out first.
+  ExecutionCount* counts;
+  int count = wrenFunctionExecutionCounts(vm, &counts);
+  wrenSetSlotNewMap(vm, 1);
+  for (int i = 0; i < count; i++)
+  {
+    wrenSetSlotString(vm, 2, counts[i].name);
+    wrenSetSlotDouble(vm, 3, (double)counts[i].count);
+    wrenSetMapValue(vm, 1, 2, 3);
+  }
+  vm->config.reallocateFn(counts, 0, vm->config.userData);
+  wrenSetSlotString(vm, 2, "functions");
+  wrenSetMapValue(vm, 0, 2, 1);
+
+  wrenSetSlotNewMap(vm, 1);
+  for (int i = 0; i < vm->callCountsCapacity; i++)
+  {
+    if (vm->callCounts[i] == 0) continue;
+    wrenSetSlotString(vm, 2, vm->methodNames.data[i]->value);
+    wrenSetSlotDouble(vm, 3, (double)vm->callCounts[i]);
+    wrenSetMapValue(vm, 1, 2, 3);
+  }
+  wrenSetSlotString(vm, 2, "calls");
+  wrenSetMapValue(vm, 0, 2, 1);
+#else
+  wrenSetSlotNull(vm, 0);
+#endif
+}
+
+void metaResetExecutionCounts(WrenVM* vm)
+{
+#if WREN_DEBUG_COUNT_EXECUTION
+  wrenResetExecutionCounts(vm);
+#endif
+  wrenSetSlotNull(vm, 0);
+}
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+static void returnAllocations(WrenVM* vm, bool frame)
+{
+  // Copy the sites out first, since filling in the list allocates.
+  AllocationSite* sites;
+  int count = wrenSortedAllocations(vm, frame, &sites);
+
+  wrenEnsureSlots(vm, 3);
+  wrenSetSlotNewList(vm, 0);
+  for (int i = 0; i < count; i++)
+  {
+    wrenSetSlotNewList(vm, 1);
+    wrenSetSlotString(vm, 2, sites[i].site);
+    wrenInsertInList(vm, 1, -1, 2);
+    wrenSetSlotString(vm, 2, sites[i].kindName);
+    wrenInsertInList(vm, 1, -1, 2);
+    wrenSetSlotDouble(vm, 2, (double)sites[i].count);
+    wrenInsertInList(vm, 1, -1, 2);
+    wrenSetSlotDouble(vm, 2, (double)sites[i].bytes);
+    wrenInsertInList(vm, 1, -1, 2);
+    wrenInsertInList(vm, 0, -1, 1);
+  }
+
+  vm->config.reallocateFn(sites, 0, vm->config.userData);
+}
+#endif
+
+// Returns a list of [site, kind, count, bytes] lists, most bytes first, or null
+// if the VM wasn't built with WREN_DEBUG_TRACK_ALLOCATIONS.
+void metaAllocations(WrenVM* vm)
+{
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  returnAllocations(vm, false);
+#else
+  wrenSetSlotNull(vm, 0);
+#endif
+}
+
+void metaFrameAllocations(WrenVM* vm)
+{
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  returnAllocations(vm, true);
+#else
+  wrenSetSlotNull(vm, 0);
+#endif
+}
+
+void metaResetFrameAllocations(WrenVM* vm)
+{
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  wrenResetFrameAllocations(vm);
+#endif
+  wrenSetSlotNull(vm, 0);
+}
+
+static void setMapNumber(WrenVM* vm, const char* key, double value)
+{
+  wrenSetSlotString(vm, 1, key);
+  wrenSetSlotDouble(vm, 2, value);
+  wrenSetMapValue(vm, 0, 1, 2);
+}
+
+// Returns a map of the garbage collector's running totals. Pauses are in
+// milliseconds and heap sizes in bytes.
+void metaGcStats(WrenVM* vm)
+{
+  GCStats* stats = &vm->gcStats;
+
+  wrenEnsureSlots(vm, 3);
+  wrenSetSlotNewMap(vm, 0);
+  setMapNumber(vm, "collections", (double)stats->collections);
+  setMapNumber(vm, "totalPause", stats->totalPause * 1000.0);
+  setMapNumber(vm, "maxPause", stats->maxPause * 1000.0);
+  setMapNumber(vm, "lastPause", stats->lastPause * 1000.0);
+  setMapNumber(vm, "heapBefore", (double)stats->heapBefore);
+  setMapNumber(vm, "heapAfter", (double)stats->heapAfter);
+  setMapNumber(vm, "bytesAllocated", (double)vm->bytesAllocated);
+  setMapNumber(vm, "nextGC", (double)vm->nextGC);
+  setMapNumber(vm, "idleGC", (double)vm->idleGC);
+}
+
+// Returns a map describing the slab allocator's pages and the allocations it
+// has served, or null if the VM doesn't use it.
+void metaAllocatorStats(WrenVM* vm)
+{
+  if (vm->slab == NULL)
+  {
+    wrenSetSlotNull(vm, 0);
+    return;
+  }
+
+  WrenSlabStats stats;
+  wrenSlabGetStats(vm->slab, &stats);
+
+  wrenEnsureSlots(vm, 3);
+  wrenSetSlotNewMap(vm, 0);
+  setMapNumber(vm, "chunks", (double)stats.chunks);
+  setMapNumber(vm, "pages", (double)stats.pages);
+  setMapNumber(vm, "usedPages", (double)stats.usedPages);
+  setMapNumber(vm, "bytesReserved", (double)stats.bytesReserved);
+  setMapNumber(vm, "bytesUsed", (double)stats.bytesUsed);
+  setMapNumber(vm, "smallAllocations", (double)stats.smallAllocations);
+  setMapNumber(vm, "largeAllocations", (double)stats.largeAllocations);
+  setMapNumber(vm, "remoteFrees", (double)stats.remoteFrees);
+}
+
+// Stores a list of [name, count, bytes] lists for [entries] in [slot] and frees
+// them.
+static void censusList(WrenVM* vm, int slot, HeapCensusEntry* entries,
+                       int count)
+{
+  wrenSetSlotNewList(vm, slot);
+  for (int i = 0; i < count; i++)
+  {
+    wrenSetSlotNewList(vm, slot + 1);
+    wrenSetSlotString(vm, slot + 2, entries[i].name);
+    wrenInsertInList(vm, slot + 1, -1, slot + 2);
+    wrenSetSlotDouble(vm, slot + 2, (double)entries[i].count);
+    wrenInsertInList(vm, slot + 1, -1, slot + 2);
+    wrenSetSlotDouble(vm, slot + 2, (double)entries[i].bytes);
+    wrenInsertInList(vm, slot + 1, -1, slot + 2);
+    wrenInsertInList(vm, slot, -1, slot + 1);
+  }
+
+  vm->config.reallocateFn(entries, 0, vm->config.userData);
+}
+
+// Collects garbage and returns a map with lists of the live objects counted by
+// ObjType under "types" and by class under "classes", most bytes first.
+void metaHeapCensus(WrenVM* vm)
+{
+  wrenCollectGarbage(vm);
+
+  // Take both censuses before allocating the result so neither counts it.
+  HeapCensusEntry* types;
+  HeapCensusEntry* classes;
+  int typeCount = wrenHeapCensus(vm, false, &types);
+  int classCount = wrenHeapCensus(vm, true, &classes);
+
+  wrenEnsureSlots(vm, 5);
+  wrenSetSlotNewMap(vm, 0);
+
+  censusList(vm, 2, types, typeCount);
+  wrenSetSlotString(vm, 1, "types");
+  wrenSetMapValue(vm, 0, 1, 2);
+
+  censusList(vm, 2, classes, classCount);
+  wrenSetSlotString(vm, 1, "classes");
+  wrenSetMapValue(vm, 0, 1, 2);
+}
+
 const char* wrenMetaSource()
 {
   return metaModuleSource;
@@ -75,7 +284,6 @@ WrenForeignMethodFn wrenMetaBindForeignMethod(WrenVM* vm,
                                               bool isStatic,
                                               const char* signature)
 {
-  // There is only one foreign method in the meta module.
   ASSERT(strcmp(className, "Meta") == 0, "Should be in Meta class.");
   ASSERT(isStatic, "Should be static.");
   
@@ -88,6 +296,46 @@ WrenForeignMethodFn wrenMetaBindForeignMethod(WrenVM* vm,
   {
     return metaGetModuleVariables;
   }
+
+  if (strcmp(signature, "executionCounts") == 0)
+  {
+    return metaExecutionCounts;
+  }
+
+  if (strcmp(signature, "resetExecutionCounts()") == 0)
+  {
+    return metaResetExecutionCounts;
+  }
+
+  if (strcmp(signature, "allocations") == 0)
+  {
+    return metaAllocations;
+  }
+
+  if (strcmp(signature, "frameAllocations") == 0)
+  {
+    return metaFrameAllocations;
+  }
+
+  if (strcmp(signature, "resetFrameAllocations()") == 0)
+  {
+    return metaResetFrameAllocations;
+  }
+
+  if (strcmp(signature, "gcStats") == 0)
+  {
+    return metaGcStats;
+  }
+
+  if (strcmp(signature, "heapCensus") == 0)
+  {
+    return metaHeapCensus;
+  }
+
+  if (strcmp(signature, "allocatorStats") == 0)
+  {
+    return metaAllocatorStats;
+  }
   
   ASSERT(false, "Unknown method.");
   return NULL;
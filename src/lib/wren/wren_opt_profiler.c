@@ -0,0 +1,391 @@
+// sigaction() and the POSIX timers are POSIX rather than standard C.
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "wren_opt_profiler.h"
+
+#if WREN_OPT_PROFILER
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <signal.h>
+  #include <sys/time.h>
+  #include <time.h>
+#endif
+
+#include "wren_vm.h"
+#include "wren_opt_profiler.wren.inc"
+
+// Folded stacks longer than this are truncated.
+#define MAX_STACK_LENGTH 4096
+
+// Fibers nested deeper than this are left out of a sample.
+#define MAX_FIBER_DEPTH 64
+
+typedef struct
+{
+  char* stack;
+  uint32_t hash;
+  int count;
+} ProfileEntry;
+
+// The timer is process-wide, so only one VM can be profiled at a time and the
+// profiler state is kept here rather than in the VM.
+static struct
+{
+  // The VM being profiled, or NULL if the profiler isn't running.
+  WrenVM* vm;
+
+  // Open addressing hash table from folded stack to the number of samples
+  // taken in it.
+  ProfileEntry* entries;
+  int capacity;
+  int count;
+
+  int samples;
+} profile;
+
+volatile int wrenProfilerPending = 0;
+
+// The profiler's bookkeeping goes through the host's allocator, but not through
+// wrenReallocate(), so it is neither counted towards nor able to trigger a GC.
+static void* reallocate(WrenVM* vm, void* memory, size_t newSize)
+{
+  return vm->config.reallocateFn(memory, newSize, vm->config.userData);
+}
+
+#ifdef _WIN32
+
+// There is no SIGPROF on Windows. A timer queue timer is used instead, which
+// measures wall clock time rather than CPU time.
+static HANDLE timer = NULL;
+
+static VOID CALLBACK handleTimer(PVOID parameter, BOOLEAN timerOrWaitFired)
+{
+  wrenProfilerPending = 1;
+}
+
+static void startTimer(double intervalMs)
+{
+  DWORD period = intervalMs < 1 ? 1 : (DWORD)intervalMs;
+  CreateTimerQueueTimer(&timer, NULL, handleTimer, NULL, period, period,
+                        WT_EXECUTEDEFAULT);
+}
+
+static void stopTimer()
+{
+  if (timer == NULL) return;
+  DeleteTimerQueueTimer(NULL, timer, INVALID_HANDLE_VALUE);
+  timer = NULL;
+}
+
+#else
+
+static void handleTimer(int signal)
+{
+  wrenProfilerPending = 1;
+}
+
+#ifdef __linux__
+
+// The timer measures the CPU time of the thread that starts the profiler, so
+// the GC's background sweeper thread doesn't produce samples that would be
+// charged to whatever Wren code is running. The signal may still be delivered
+// to any thread, which is fine since the handler only sets a flag.
+static timer_t timer;
+static bool hasTimer = false;
+
+static void startCpuTimer(long microseconds)
+{
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGPROF;
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) return;
+  hasTimer = true;
+
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = microseconds / 1000000;
+  interval.it_interval.tv_nsec = (microseconds % 1000000) * 1000;
+  interval.it_value = interval.it_interval;
+  timer_settime(timer, 0, &interval, NULL);
+}
+
+static void stopCpuTimer()
+{
+  if (!hasTimer) return;
+  timer_delete(timer);
+  hasTimer = false;
+}
+
+#else
+
+// Elsewhere there are no per-thread timers, and ITIMER_PROF measures the CPU
+// time of the whole process. The background sweeper's CPU time then produces
+// samples too, which are charged to whatever Wren code is running, so code
+// that makes a lot of garbage looks more expensive than it is.
+static void startCpuTimer(long microseconds)
+{
+  struct itimerval interval;
+  interval.it_interval.tv_sec = microseconds / 1000000;
+  interval.it_interval.tv_usec = microseconds % 1000000;
+  interval.it_value = interval.it_interval;
+  setitimer(ITIMER_PROF, &interval, NULL);
+}
+
+static void stopCpuTimer()
+{
+  struct itimerval interval;
+  memset(&interval, 0, sizeof(interval));
+  setitimer(ITIMER_PROF, &interval, NULL);
+}
+
+#endif
+
+static void startTimer(double intervalMs)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleTimer;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGPROF, &action, NULL);
+
+  long microseconds = (long)(intervalMs * 1000);
+  if (microseconds < 1) microseconds = 1;
+  startCpuTimer(microseconds);
+}
+
+static void stopTimer()
+{
+  stopCpuTimer();
+  signal(SIGPROF, SIG_IGN);
+}
+
+#endif
+
+// FNV-1a.
+static uint32_t hashStack(const char* stack, int length)
+{
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+  {
+    hash ^= (uint8_t)stack[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+// Returns the entry for [stack], or the empty entry it should be stored in.
+static ProfileEntry* findEntry(ProfileEntry* entries, int capacity,
+                               const char* stack, uint32_t hash)
+{
+  uint32_t index = hash & (capacity - 1);
+  for (;;)
+  {
+    ProfileEntry* entry = &entries[index];
+    if (entry->stack == NULL) return entry;
+    if (entry->hash == hash && strcmp(entry->stack, stack) == 0) return entry;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growEntries(WrenVM* vm)
+{
+  int capacity = profile.capacity == 0 ? 256 : profile.capacity * 2;
+  ProfileEntry* entries = (ProfileEntry*)reallocate(vm, NULL,
+                                                    sizeof(ProfileEntry) * capacity);
+  memset(entries, 0, sizeof(ProfileEntry) * capacity);
+
+  for (int i = 0; i < profile.capacity; i++)
+  {
+    ProfileEntry* old = &profile.entries[i];
+    if (old->stack == NULL) continue;
+    *findEntry(entries, capacity, old->stack, old->hash) = *old;
+  }
+
+  reallocate(vm, profile.entries, 0);
+  profile.entries = entries;
+  profile.capacity = capacity;
+}
+
+static void freeEntries(WrenVM* vm)
+{
+  for (int i = 0; i < profile.capacity; i++)
+  {
+    reallocate(vm, profile.entries[i].stack, 0);
+  }
+  reallocate(vm, profile.entries, 0);
+  profile.entries = NULL;
+  profile.capacity = 0;
+  profile.count = 0;
+  profile.samples = 0;
+}
+
+// Appends the frames of [fiber], outermost first, to [stack].
+static int appendFrames(ObjFiber* fiber, char* stack, int length)
+{
+  for (int i = 0; i < fiber->numFrames; i++)
+  {
+    CallFrame* frame = &fiber->frames[i];
+    ObjFn* fn = frame->closure->fn;
+
+    // Skip over stub functions for calling methods from the C API.
+    if (fn->module == NULL) continue;
+
+    // -1 because IP has advanced past the instruction that it just executed.
+    int line = 0;
+    if (frame->ip > fn->code.data)
+    {
+      line = fn->debug->sourceLines.data[frame->ip - fn->code.data - 1];
+    }
+
+    // The built-in core module has no name. Hosts may well have a module
+    // called "core" of their own, so use a name that can't be imported.
+    const char* module = fn->module->name == NULL
+        ? "<core>" : fn->module->name->value;
+    length += snprintf(stack + length, MAX_STACK_LENGTH - length,
+                       "%s%s (%s:%d)", length > 0 ? ";" : "",
+                       fn->debug->name, module, line);
+    if (length >= MAX_STACK_LENGTH - 1) return MAX_STACK_LENGTH - 1;
+  }
+
+  return length;
+}
+
+void wrenProfilerSample(WrenVM* vm)
+{
+  wrenProfilerPending = 0;
+  if (profile.vm != vm || vm->fiber == NULL) return;
+
+  // Walk up to the root fiber so the stack includes the fibers that resumed
+  // the current one.
+  ObjFiber* fibers[MAX_FIBER_DEPTH];
+  int numFibers = 0;
+  for (ObjFiber* fiber = vm->fiber;
+       fiber != NULL && numFibers < MAX_FIBER_DEPTH;
+       fiber = fiber->caller)
+  {
+    fibers[numFibers++] = fiber;
+  }
+
+  char stack[MAX_STACK_LENGTH];
+  int length = 0;
+  stack[0] = '\0';
+  for (int i = numFibers - 1; i >= 0; i--)
+  {
+    length = appendFrames(fibers[i], stack, length);
+  }
+  if (length == 0) return;
+
+  if (profile.count + 1 > profile.capacity * 3 / 4) growEntries(vm);
+
+  uint32_t hash = hashStack(stack, length);
+  ProfileEntry* entry = findEntry(profile.entries, profile.capacity, stack,
+                                  hash);
+  if (entry->stack == NULL)
+  {
+    entry->stack = (char*)reallocate(vm, NULL, length + 1);
+    memcpy(entry->stack, stack, length + 1);
+    entry->hash = hash;
+    profile.count++;
+  }
+
+  entry->count++;
+  profile.samples++;
+}
+
+void wrenProfilerStart(WrenVM* vm, double intervalMs)
+{
+  if (profile.vm != NULL) return;
+
+  profile.vm = vm;
+  wrenProfilerPending = 0;
+  startTimer(intervalMs);
+}
+
+bool wrenProfilerIsRunning(WrenVM* vm)
+{
+  return profile.vm == vm;
+}
+
+bool wrenProfilerStop(WrenVM* vm, const char* path)
+{
+  if (profile.vm != vm) return false;
+
+  stopTimer();
+  wrenProfilerPending = 0;
+  profile.vm = NULL;
+
+  bool success = true;
+  if (path != NULL)
+  {
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+      success = false;
+    }
+    else
+    {
+      for (int i = 0; i < profile.capacity; i++)
+      {
+        ProfileEntry* entry = &profile.entries[i];
+        if (entry->stack == NULL) continue;
+        fprintf(file, "%s %d\n", entry->stack, entry->count);
+      }
+      success = fclose(file) == 0;
+    }
+  }
+
+  freeEntries(vm);
+  return success;
+}
+
+static void profilerIsRunning(WrenVM* vm)
+{
+  wrenSetSlotBool(vm, 0, wrenProfilerIsRunning(vm));
+}
+
+static void profilerSampleCount(WrenVM* vm)
+{
+  wrenSetSlotDouble(vm, 0, profile.samples);
+}
+
+static void profilerStart(WrenVM* vm)
+{
+  wrenProfilerStart(vm, wrenGetSlotDouble(vm, 1));
+  wrenSetSlotNull(vm, 0);
+}
+
+static void profilerStop(WrenVM* vm)
+{
+  wrenSetSlotBool(vm, 0, wrenProfilerStop(vm, wrenGetSlotString(vm, 1)));
+}
+
+const char* wrenProfilerSource()
+{
+  return profilerModuleSource;
+}
+
+WrenForeignMethodFn wrenProfilerBindForeignMethod(WrenVM* vm,
+                                                  const char* className,
+                                                  bool isStatic,
+                                                  const char* signature)
+{
+  ASSERT(strcmp(className, "Profiler") == 0, "Should be in Profiler class.");
+  ASSERT(isStatic, "Should be static.");
+
+  if (strcmp(signature, "isRunning") == 0) return profilerIsRunning;
+  if (strcmp(signature, "sampleCount") == 0) return profilerSampleCount;
+  if (strcmp(signature, "start_(_)") == 0) return profilerStart;
+  if (strcmp(signature, "stop_(_)") == 0) return profilerStop;
+
+  ASSERT(false, "Unknown method.");
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef wren_opt_profiler_h
+#define wren_opt_profiler_h
+
+#include "wren_common.h"
+#include "wren.h"
+
+// This module defines the Profiler class, a sampling profiler for Wren code.
+//
+// A timer periodically raises [wrenProfilerPending]. The interpreter checks it
+// at calls and loop back-edges and, when set, records the current fiber's call
+// stack. Samples are aggregated as folded stacks, the input format of
+// flamegraph.pl and compatible tools.
+#if WREN_OPT_PROFILER
+
+extern volatile int wrenProfilerPending;
+
+const char* wrenProfilerSource();
+WrenForeignMethodFn wrenProfilerBindForeignMethod(WrenVM* vm,
+                                                  const char* className,
+                                                  bool isStatic,
+                                                  const char* signature);
+
+// Starts sampling [vm] every [intervalMs] milliseconds of CPU time used by the
+// calling thread (by the whole process where there are no per-thread timers,
+// and of wall clock time on Windows). Does nothing if the profiler is already
+// running.
+void wrenProfilerStart(WrenVM* vm, double intervalMs);
+
+// Returns true if [vm] is being profiled.
+bool wrenProfilerIsRunning(WrenVM* vm);
+
+// Stops the profiler and writes the collected folded stacks to [path]. Returns
+// false if [vm] wasn't being profiled or the file couldn't be written.
+bool wrenProfilerStop(WrenVM* vm, const char* path);
+
+// Records the call stack of the current fiber. Called by the interpreter when
+// [wrenProfilerPending] is set.
+void wrenProfilerSample(WrenVM* vm);
+
+#endif
+
+#endif
@@ -45,6 +45,16 @@ bool validateInt(WrenVM* vm, Value arg, const char* argName)
   return validateIntValue(vm, AS_NUM(arg), argName);
 }
 
+bool validateByte(WrenVM* vm, Value arg, const char* argName)
+{
+  if (!validateInt(vm, arg, argName)) return false;
+
+  double value = AS_NUM(arg);
+  if (value < 0) RETURN_ERROR_FMT("$ cannot be negative.", argName);
+  if (value > 0xff) RETURN_ERROR_FMT("$ cannot be greater than 0xff.", argName);
+  return true;
+}
+
 bool validateKey(WrenVM* vm, Value arg)
 {
   if (wrenMapIsValidKey(arg)) return true;
@@ -52,6 +62,13 @@ bool validateKey(WrenVM* vm, Value arg)
   RETURN_ERROR("Key must be a value type.");
 }
 
+bool validateWeakKey(WrenVM* vm, Value arg, const char* argName)
+{
+  if (IS_OBJ(arg) && !IS_STRING(arg) && !IS_RANGE(arg)) return true;
+  RETURN_ERROR_FMT("$ must be an object other than a string or range.",
+                   argName);
+}
+
 uint32_t validateIndex(WrenVM* vm, Value arg, uint32_t count,
                        const char* argName)
 {
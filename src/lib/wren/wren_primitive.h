@@ -79,10 +79,19 @@ bool validateIntValue(WrenVM* vm, double value, const char* argName);
 // reports an error and returns false.
 bool validateInt(WrenVM* vm, Value arg, const char* argName);
 
+// Validates that the given [arg] is an integer from 0 to 255. Returns true if
+// it is. If not, reports an error and returns false.
+bool validateByte(WrenVM* vm, Value arg, const char* argName);
+
 // Validates that [arg] is a valid object for use as a map key. Returns true if
 // it is. If not, reports an error and returns false.
 bool validateKey(WrenVM* vm, Value arg);
 
+// Validates that [arg] can be held weakly, which is any object except the ones
+// that behave like values. Returns true if it can. If not, reports an error and
+// returns false.
+bool validateWeakKey(WrenVM* vm, Value arg, const char* argName);
+
 // Validates that the argument at [argIndex] is an integer within `[0, count)`.
 // Also allows negative indices which map backwards from the end. Returns the
 // valid positive index value. If invalid, reports an error and returns
@@ -0,0 +1,550 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "wren_slab.h"
+#include "wren_vm.h"
+
+#if WREN_BACKGROUND_SWEEP
+  #ifdef _WIN32
+    #include <windows.h>
+  #else
+    #include <pthread.h>
+  #endif
+
+  #if defined(_MSC_VER)
+    #define THREAD_LOCAL __declspec(thread)
+  #else
+    #define THREAD_LOCAL __thread
+  #endif
+#endif
+
+// Pages are aligned to their size, so the page a block is in can be found by
+// masking its address.
+#define SLAB_PAGE_SIZE WREN_SLAB_PAGE_SIZE
+
+// The space at the start of each page reserved for the mark bitmaps and the
+// page's header. It keeps the blocks after it 16-byte aligned.
+#define BITMAPS (2 * WREN_SLAB_BITMAP_BYTES)
+#define PAGE_HEADER (BITMAPS + 64)
+
+// The number of pages taken from the host at a time.
+#define CHUNK_PAGES 64
+
+// The largest allocation served from a page. Larger ones go to the host.
+#define MAX_SMALL 512
+
+// Size classes are 16 bytes apart up to 128 bytes and 32 bytes apart after
+// that, up to [MAX_SMALL].
+#define NUM_CLASSES 20
+
+typedef struct sSlabPage
+{
+  // The neighbors in the list of pages with free blocks of the page's size
+  // class, or in the list of empty pages.
+  struct sSlabPage* prev;
+  struct sSlabPage* next;
+
+  // The blocks that have been freed, linked through their first word.
+  void* free;
+
+  // The next block that has never been allocated.
+  char* bump;
+
+  // The size of the page's blocks, and how many of them are allocated. Blocks
+  // freed on another thread count as allocated until they are taken back.
+  uint32_t blockSize;
+  uint32_t used;
+
+  int sizeClass;
+
+  // Whether the page is in the list of pages with free blocks.
+  bool isAvailable;
+} SlabPage;
+
+typedef struct
+{
+  // The first page of the chunk and the memory the host returned for it.
+  char* start;
+  void* memory;
+
+  // The number of pages in the chunk that aren't used by any size class.
+  int emptyPages;
+} SlabChunk;
+
+struct sWrenSlab
+{
+  WrenVM* vm;
+
+  // For each size class, the pages that have free blocks.
+  SlabPage* available[NUM_CLASSES];
+
+  // The pages not used by any size class.
+  SlabPage* empty;
+  int emptyCount;
+
+  // The chunks taken from the host, ordered by address.
+  SlabChunk* chunks;
+  int chunkCount;
+  int chunkCapacity;
+
+#if WREN_BACKGROUND_SWEEP
+  // Guards [remote], and [chunks] against the threads that only free. The VM's
+  // thread is the only one that changes [chunks], so it can read them without
+  // taking the lock.
+#ifdef _WIN32
+  CRITICAL_SECTION lock;
+#else
+  pthread_mutex_t lock;
+#endif
+
+  // The blocks freed on other threads, linked through their first word.
+  void* remote;
+#endif
+
+  WrenSlabStats stats;
+};
+
+#if WREN_BACKGROUND_SWEEP
+
+static THREAD_LOCAL bool isRemoteThread = false;
+
+#ifdef _WIN32
+
+static void initLock(WrenSlab* slab) { InitializeCriticalSection(&slab->lock); }
+static void freeLock(WrenSlab* slab) { DeleteCriticalSection(&slab->lock); }
+static void lockSlab(WrenSlab* slab) { EnterCriticalSection(&slab->lock); }
+static void unlockSlab(WrenSlab* slab) { LeaveCriticalSection(&slab->lock); }
+
+#else
+
+static void initLock(WrenSlab* slab) { pthread_mutex_init(&slab->lock, NULL); }
+static void freeLock(WrenSlab* slab) { pthread_mutex_destroy(&slab->lock); }
+static void lockSlab(WrenSlab* slab) { pthread_mutex_lock(&slab->lock); }
+static void unlockSlab(WrenSlab* slab) { pthread_mutex_unlock(&slab->lock); }
+
+#endif
+
+#else
+
+static void initLock(WrenSlab* slab) {}
+static void freeLock(WrenSlab* slab) {}
+static void lockSlab(WrenSlab* slab) {}
+static void unlockSlab(WrenSlab* slab) {}
+
+#endif
+
+static int classOf(size_t size)
+{
+  if (size <= 128) return size == 0 ? 0 : (int)((size - 1) / 16);
+  return 8 + (int)((size - 129) / 32);
+}
+
+static uint32_t classSize(int sizeClass)
+{
+  if (sizeClass < 8) return 16 * (sizeClass + 1);
+  return 128 + 32 * (sizeClass - 7);
+}
+
+static void* reallocateHost(WrenSlab* slab, void* memory, size_t newSize)
+{
+  return slab->vm->config.reallocateFn(memory, newSize,
+                                       slab->vm->config.userData);
+}
+
+static void linkPage(SlabPage** list, SlabPage* page)
+{
+  page->prev = NULL;
+  page->next = *list;
+  if (*list != NULL) (*list)->prev = page;
+  *list = page;
+}
+
+static void unlinkPage(SlabPage** list, SlabPage* page)
+{
+  if (page->prev != NULL)
+  {
+    page->prev->next = page->next;
+  }
+  else
+  {
+    *list = page->next;
+  }
+
+  if (page->next != NULL) page->next->prev = page->prev;
+}
+
+// Returns the index of the chunk [memory] is in, or -1 if it isn't in one.
+static int findChunk(WrenSlab* slab, const void* memory)
+{
+  uintptr_t address = (uintptr_t)memory;
+  int low = 0;
+  int high = slab->chunkCount - 1;
+  while (low <= high)
+  {
+    int mid = low + (high - low) / 2;
+    uintptr_t start = (uintptr_t)slab->chunks[mid].start;
+    if (address < start)
+    {
+      high = mid - 1;
+    }
+    else if (address >= start + CHUNK_PAGES * SLAB_PAGE_SIZE)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      return mid;
+    }
+  }
+
+  return -1;
+}
+
+// Returns the start of the page [memory] is in.
+static char* pageStart(const void* memory)
+{
+  return (char*)((uintptr_t)memory & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+// Returns the header of the page that begins at [start].
+static SlabPage* pageAt(char* start)
+{
+  return (SlabPage*)(start + BITMAPS);
+}
+
+static SlabPage* pageOf(const void* block)
+{
+  return pageAt(pageStart(block));
+}
+
+// Takes another chunk from the host and adds its pages to the empty ones.
+static bool addChunk(WrenSlab* slab)
+{
+  // Take an extra page to be able to align the others.
+  void* memory = reallocateHost(slab, NULL,
+                                (CHUNK_PAGES + 1) * SLAB_PAGE_SIZE);
+  if (memory == NULL) return false;
+  char* start = pageStart((char*)memory + SLAB_PAGE_SIZE - 1);
+
+  lockSlab(slab);
+  if (slab->chunkCount == slab->chunkCapacity)
+  {
+    int capacity = slab->chunkCapacity == 0 ? 4 : slab->chunkCapacity * 2;
+    SlabChunk* chunks = (SlabChunk*)reallocateHost(slab, slab->chunks,
+        capacity * sizeof(SlabChunk));
+    if (chunks == NULL)
+    {
+      unlockSlab(slab);
+      reallocateHost(slab, memory, 0);
+      return false;
+    }
+
+    slab->chunks = chunks;
+    slab->chunkCapacity = capacity;
+  }
+
+  int i = slab->chunkCount;
+  while (i > 0 && (uintptr_t)slab->chunks[i - 1].start > (uintptr_t)start)
+  {
+    slab->chunks[i] = slab->chunks[i - 1];
+    i--;
+  }
+  slab->chunks[i].start = start;
+  slab->chunks[i].memory = memory;
+  slab->chunks[i].emptyPages = CHUNK_PAGES;
+  slab->chunkCount++;
+  unlockSlab(slab);
+
+  // Link them backwards so the pages are handed out in address order.
+  for (int page = CHUNK_PAGES - 1; page >= 0; page--)
+  {
+    memset(start + page * SLAB_PAGE_SIZE, 0, BITMAPS);
+    linkPage(&slab->empty, pageAt(start + page * SLAB_PAGE_SIZE));
+  }
+  slab->emptyCount += CHUNK_PAGES;
+  return true;
+}
+
+// Gives the chunk at [index], whose pages are all empty, back to the host.
+static void removeChunk(WrenSlab* slab, int index)
+{
+  char* start = slab->chunks[index].start;
+  for (int page = 0; page < CHUNK_PAGES; page++)
+  {
+    unlinkPage(&slab->empty, pageAt(start + page * SLAB_PAGE_SIZE));
+  }
+  slab->emptyCount -= CHUNK_PAGES;
+
+  void* memory = slab->chunks[index].memory;
+
+  lockSlab(slab);
+  memmove(&slab->chunks[index], &slab->chunks[index + 1],
+          (slab->chunkCount - index - 1) * sizeof(SlabChunk));
+  slab->chunkCount--;
+  unlockSlab(slab);
+
+  reallocateHost(slab, memory, 0);
+}
+
+static SlabPage* takeEmptyPage(WrenSlab* slab)
+{
+  if (slab->empty == NULL && !addChunk(slab)) return NULL;
+
+  SlabPage* page = slab->empty;
+  unlinkPage(&slab->empty, page);
+  slab->emptyCount--;
+  slab->chunks[findChunk(slab, page)].emptyPages--;
+  return page;
+}
+
+static void releasePage(WrenSlab* slab, SlabPage* page)
+{
+  linkPage(&slab->empty, page);
+  slab->emptyCount++;
+
+  // Keep a chunk's worth of empty pages around besides a chunk that empties
+  // out, so a heap that shrinks and grows again doesn't keep giving chunks
+  // back and taking them again.
+  int index = findChunk(slab, page);
+  if (++slab->chunks[index].emptyPages == CHUNK_PAGES &&
+      slab->emptyCount >= 2 * CHUNK_PAGES)
+  {
+    removeChunk(slab, index);
+  }
+}
+
+static void freeSmall(WrenSlab* slab, SlabPage* page, void* block)
+{
+  *(void**)block = page->free;
+  page->free = block;
+  page->used--;
+  slab->stats.bytesUsed -= page->blockSize;
+
+  SlabPage** available = &slab->available[page->sizeClass];
+  if (!page->isAvailable)
+  {
+    page->isAvailable = true;
+    linkPage(available, page);
+  }
+
+  // A size class keeps its last page even when it's empty, so that allocating
+  // and freeing a single block doesn't take and release a page each time.
+  if (page->used == 0 && (page->prev != NULL || page->next != NULL))
+  {
+    unlinkPage(available, page);
+    releasePage(slab, page);
+  }
+}
+
+#if WREN_BACKGROUND_SWEEP
+static void takeRemoteFrees(WrenSlab* slab)
+{
+  lockSlab(slab);
+  void* block = slab->remote;
+  slab->remote = NULL;
+  unlockSlab(slab);
+
+  while (block != NULL)
+  {
+    void* next = *(void**)block;
+    freeSmall(slab, pageOf(block), block);
+    block = next;
+  }
+}
+
+static void freeRemote(WrenSlab* slab, void* memory)
+{
+  lockSlab(slab);
+  if (findChunk(slab, memory) != -1)
+  {
+    *(void**)memory = slab->remote;
+    slab->remote = memory;
+    slab->stats.remoteFrees++;
+    unlockSlab(slab);
+    return;
+  }
+  unlockSlab(slab);
+
+  reallocateHost(slab, memory, 0);
+}
+#endif
+
+static void* allocateSmall(WrenSlab* slab, size_t size)
+{
+  int sizeClass = classOf(size);
+  SlabPage* page = slab->available[sizeClass];
+  if (page == NULL)
+  {
+#if WREN_BACKGROUND_SWEEP
+    // Reuse what other threads have freed before taking another page.
+    takeRemoteFrees(slab);
+    page = slab->available[sizeClass];
+#endif
+
+    if (page == NULL)
+    {
+      page = takeEmptyPage(slab);
+      if (page == NULL) return NULL;
+
+      page->free = NULL;
+      page->bump = pageStart(page) + PAGE_HEADER;
+      page->blockSize = classSize(sizeClass);
+      page->used = 0;
+      page->sizeClass = sizeClass;
+      page->isAvailable = true;
+      linkPage(&slab->available[sizeClass], page);
+    }
+  }
+
+  void* block;
+  if (page->free != NULL)
+  {
+    block = page->free;
+    page->free = *(void**)block;
+  }
+  else
+  {
+    block = page->bump;
+    page->bump += page->blockSize;
+  }
+  page->used++;
+
+  // Full pages leave the list until a block in them is freed.
+  if (page->free == NULL &&
+      page->bump + page->blockSize > pageStart(page) + SLAB_PAGE_SIZE)
+  {
+    unlinkPage(&slab->available[sizeClass], page);
+    page->isAvailable = false;
+  }
+
+  slab->stats.smallAllocations++;
+  slab->stats.bytesUsed += page->blockSize;
+  return block;
+}
+
+WrenSlab* wrenNewSlab(WrenVM* vm)
+{
+  WrenSlab* slab = (WrenSlab*)vm->config.reallocateFn(NULL, sizeof(WrenSlab),
+                                                      vm->config.userData);
+  memset(slab, 0, sizeof(WrenSlab));
+  slab->vm = vm;
+  initLock(slab);
+  return slab;
+}
+
+void wrenFreeSlab(WrenSlab* slab)
+{
+  for (int i = 0; i < slab->chunkCount; i++)
+  {
+    reallocateHost(slab, slab->chunks[i].memory, 0);
+  }
+  reallocateHost(slab, slab->chunks, 0);
+
+  freeLock(slab);
+  reallocateHost(slab, slab, 0);
+}
+
+void* wrenSlabReallocate(WrenSlab* slab, void* memory, size_t newSize)
+{
+  if (memory == NULL)
+  {
+    if (newSize == 0) return NULL;
+    if (newSize <= MAX_SMALL) return allocateSmall(slab, newSize);
+
+    slab->stats.largeAllocations++;
+    return reallocateHost(slab, NULL, newSize);
+  }
+
+#if WREN_BACKGROUND_SWEEP
+  if (isRemoteThread)
+  {
+    ASSERT(newSize == 0, "Only the VM's thread can allocate.");
+    freeRemote(slab, memory);
+    return NULL;
+  }
+#endif
+
+  if (findChunk(slab, memory) == -1)
+  {
+    if (newSize == 0 || newSize > MAX_SMALL)
+    {
+      return reallocateHost(slab, memory, newSize);
+    }
+
+    // A large block that shrinks enough moves into a page. Since every block
+    // the slab passes on to the host is larger than [MAX_SMALL], it holds at
+    // least [newSize] bytes. Other memory from the host, like the names
+    // returned by resolveModuleFn, is only ever freed.
+    void* block = allocateSmall(slab, newSize);
+    if (block == NULL) return NULL;
+
+    memcpy(block, memory, newSize);
+    reallocateHost(slab, memory, 0);
+    return block;
+  }
+
+  SlabPage* page = pageOf(memory);
+  if (newSize == 0)
+  {
+    freeSmall(slab, page, memory);
+    return NULL;
+  }
+
+  if (newSize <= MAX_SMALL && classOf(newSize) == page->sizeClass)
+  {
+    return memory;
+  }
+
+  void* block = wrenSlabReallocate(slab, NULL, newSize);
+  if (block == NULL) return NULL;
+
+  memcpy(block, memory, newSize < page->blockSize ? newSize : page->blockSize);
+  freeSmall(slab, page, memory);
+  return block;
+}
+
+void wrenSlabReclaim(WrenSlab* slab)
+{
+#if WREN_BACKGROUND_SWEEP
+  takeRemoteFrees(slab);
+#endif
+}
+
+void wrenSlabSetRemoteThread()
+{
+#if WREN_BACKGROUND_SWEEP
+  isRemoteThread = true;
+#endif
+}
+
+void wrenSlabGetStats(WrenSlab* slab, WrenSlabStats* stats)
+{
+  wrenSlabReclaim(slab);
+
+  lockSlab(slab);
+  *stats = slab->stats;
+  unlockSlab(slab);
+
+  stats->chunks = slab->chunkCount;
+  stats->pages = slab->chunkCount * CHUNK_PAGES;
+  stats->usedPages = stats->pages - slab->emptyCount;
+  stats->bytesReserved = (size_t)slab->chunkCount * (CHUNK_PAGES + 1) *
+                         SLAB_PAGE_SIZE;
+}
+
+bool wrenSlabContains(WrenSlab* slab, const void* memory)
+{
+  return findChunk(slab, memory) != -1;
+}
+
+void wrenSlabClearMarks(WrenSlab* slab)
+{
+  for (int i = 0; i < slab->chunkCount; i++)
+  {
+    for (int page = 0; page < CHUNK_PAGES; page++)
+    {
+      memset(slab->chunks[i].start + page * SLAB_PAGE_SIZE, 0,
+             WREN_SLAB_BITMAP_BYTES);
+    }
+  }
+}
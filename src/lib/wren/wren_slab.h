@@ -0,0 +1,123 @@
+#ifndef wren_slab_h
+#define wren_slab_h
+
+#include <stdint.h>
+
+#include "wren.h"
+#include "wren_common.h"
+
+// The slab allocator serves the many small allocations Wren makes, objects
+// like strings, upvalues and instances as well as small list and map buffers,
+// from pages of equally sized blocks. Freed blocks are reused for allocations
+// of the same size class, and pages that empty out are reused for any size
+// class, so the heap stays compact and fragments less than with `realloc`.
+//
+// Pages are carved out of larger chunks that come from the host's
+// `reallocateFn`, which also serves every allocation too large for a page.
+//
+// The free lists belong to the VM's thread. Memory freed on any other thread,
+// which is what the background sweeper does, is queued and put back on the
+// free lists by the VM's thread the next time it runs out of blocks.
+
+typedef struct sWrenSlab WrenSlab;
+
+// The size of the pages blocks are allocated from. Pages are aligned to their
+// size.
+#define WREN_SLAB_PAGE_SIZE (16 * 1024)
+
+// Each page starts with two bitmaps that have a bit for every 16 bytes of the
+// page. The garbage collector uses them to mark the objects in the page and
+// to remember which of them are on the gray stack, so that it doesn't have to
+// write to the objects themselves.
+#define WREN_SLAB_BITMAP_BYTES (WREN_SLAB_PAGE_SIZE / 16 / 8)
+
+typedef enum
+{
+  WREN_SLAB_MARKS,
+  WREN_SLAB_GRAYS
+} WrenSlabBitmap;
+
+typedef struct
+{
+  // The chunks and pages taken from the host, and the pages among them that
+  // are used by a size class. The rest are empty and waiting to be reused.
+  int chunks;
+  int pages;
+  int usedPages;
+
+  // The bytes of the chunks taken from the host, and of the blocks in them
+  // that are currently allocated.
+  size_t bytesReserved;
+  size_t bytesUsed;
+
+  // Allocations served from pages and passed on to the host because they were
+  // too large.
+  uint64_t smallAllocations;
+  uint64_t largeAllocations;
+
+  // Blocks freed on another thread and queued for the VM's thread.
+  uint64_t remoteFrees;
+} WrenSlabStats;
+
+// Creates a slab allocator that gets its memory from [vm]'s `reallocateFn`.
+WrenSlab* wrenNewSlab(WrenVM* vm);
+
+// Frees [slab] and all memory allocated from its pages. Allocations too large
+// for a page have to be freed separately.
+void wrenFreeSlab(WrenSlab* slab);
+
+// Allocates, resizes or frees [memory] like a `WrenReallocateFn`. Only frees
+// may happen on threads other than the VM's.
+void* wrenSlabReallocate(WrenSlab* slab, void* memory, size_t newSize);
+
+// Puts the memory freed on other threads so far back on the free lists. This
+// happens anyway when a size class runs out of blocks.
+void wrenSlabReclaim(WrenSlab* slab);
+
+// Marks the calling thread as one that only frees memory, so that its frees
+// are queued for the VM's thread instead of touching the free lists.
+void wrenSlabSetRemoteThread();
+
+// Fills in [stats] with the current state of [slab].
+void wrenSlabGetStats(WrenSlab* slab, WrenSlabStats* stats);
+
+// Returns true if [memory] was allocated from one of [slab]'s pages.
+bool wrenSlabContains(WrenSlab* slab, const void* memory);
+
+// Clears the mark bits of all of [slab]'s pages.
+void wrenSlabClearMarks(WrenSlab* slab);
+
+// Returns the byte of [bitmap] that holds the bit for [block], which must have
+// been allocated from a page, and sets [mask] to the bit.
+static inline uint8_t* wrenSlabBitmapByte(const void* block,
+                                          WrenSlabBitmap bitmap, uint8_t* mask)
+{
+  uintptr_t address = (uintptr_t)block;
+  uintptr_t offset = address & (WREN_SLAB_PAGE_SIZE - 1);
+  *mask = (uint8_t)(1 << ((offset / 16) % 8));
+  return (uint8_t*)(address - offset) + bitmap * WREN_SLAB_BITMAP_BYTES +
+         offset / 128;
+}
+
+static inline bool wrenSlabGetBit(const void* block, WrenSlabBitmap bitmap)
+{
+  uint8_t mask;
+  return (*wrenSlabBitmapByte(block, bitmap, &mask) & mask) != 0;
+}
+
+static inline void wrenSlabSetBit(const void* block, WrenSlabBitmap bitmap,
+                                  bool value)
+{
+  uint8_t mask;
+  uint8_t* byte = wrenSlabBitmapByte(block, bitmap, &mask);
+  if (value)
+  {
+    *byte |= mask;
+  }
+  else
+  {
+    *byte &= (uint8_t)~mask;
+  }
+}
+
+#endif
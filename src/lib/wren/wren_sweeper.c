@@ -0,0 +1,226 @@
+// The signal mask functions are POSIX rather than standard C.
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "wren_sweeper.h"
+
+#if WREN_BACKGROUND_SWEEP
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <signal.h>
+#endif
+
+#include "wren_vm.h"
+
+struct sWrenSweeper
+{
+  WrenVM* vm;
+
+#ifdef _WIN32
+  HANDLE thread;
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE wake;
+#else
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+#endif
+
+  // The objects waiting to be freed.
+  Obj* first;
+  Obj* last;
+
+  // Set when the thread should exit once everything has been freed.
+  bool stopping;
+};
+
+#ifdef _WIN32
+
+static void lockSweeper(WrenSweeper* sweeper)
+{
+  EnterCriticalSection(&sweeper->lock);
+}
+
+static void unlockSweeper(WrenSweeper* sweeper)
+{
+  LeaveCriticalSection(&sweeper->lock);
+}
+
+static void wakeSweeper(WrenSweeper* sweeper)
+{
+  WakeConditionVariable(&sweeper->wake);
+}
+
+static void waitForWork(WrenSweeper* sweeper)
+{
+  SleepConditionVariableCS(&sweeper->wake, &sweeper->lock, INFINITE);
+}
+
+#else
+
+static void lockSweeper(WrenSweeper* sweeper)
+{
+  pthread_mutex_lock(&sweeper->lock);
+}
+
+static void unlockSweeper(WrenSweeper* sweeper)
+{
+  pthread_mutex_unlock(&sweeper->lock);
+}
+
+static void wakeSweeper(WrenSweeper* sweeper)
+{
+  pthread_cond_signal(&sweeper->wake);
+}
+
+static void waitForWork(WrenSweeper* sweeper)
+{
+  pthread_cond_wait(&sweeper->wake, &sweeper->lock);
+}
+
+#endif
+
+static void runSweeper(WrenSweeper* sweeper)
+{
+  wrenSlabSetRemoteThread();
+
+  lockSweeper(sweeper);
+  for (;;)
+  {
+    while (sweeper->first == NULL && !sweeper->stopping) waitForWork(sweeper);
+    if (sweeper->first == NULL) break;
+
+    // Take everything handed over so far and free it without holding the lock,
+    // so the VM can hand over more in the meantime.
+    Obj* obj = sweeper->first;
+    sweeper->first = NULL;
+    sweeper->last = NULL;
+    unlockSweeper(sweeper);
+
+    while (obj != NULL)
+    {
+      Obj* next = wrenObjNext(obj);
+      wrenFreeObj(sweeper->vm, obj);
+      obj = next;
+    }
+
+    lockSweeper(sweeper);
+  }
+  unlockSweeper(sweeper);
+}
+
+#ifdef _WIN32
+
+static DWORD WINAPI sweeperThread(LPVOID sweeper)
+{
+  runSweeper((WrenSweeper*)sweeper);
+  return 0;
+}
+
+static bool startThread(WrenSweeper* sweeper)
+{
+  InitializeCriticalSection(&sweeper->lock);
+  InitializeConditionVariable(&sweeper->wake);
+
+  sweeper->thread = CreateThread(NULL, 0, sweeperThread, sweeper, 0, NULL);
+  if (sweeper->thread != NULL) return true;
+
+  DeleteCriticalSection(&sweeper->lock);
+  return false;
+}
+
+static void joinThread(WrenSweeper* sweeper)
+{
+  WaitForSingleObject(sweeper->thread, INFINITE);
+  CloseHandle(sweeper->thread);
+  DeleteCriticalSection(&sweeper->lock);
+}
+
+#else
+
+static void* sweeperThread(void* sweeper)
+{
+  runSweeper((WrenSweeper*)sweeper);
+  return NULL;
+}
+
+static bool startThread(WrenSweeper* sweeper)
+{
+  pthread_mutex_init(&sweeper->lock, NULL);
+  pthread_cond_init(&sweeper->wake, NULL);
+
+  // Leave signals like the profiler's SIGPROF to the host's threads.
+  sigset_t all;
+  sigset_t previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  int result = pthread_create(&sweeper->thread, NULL, sweeperThread, sweeper);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (result == 0) return true;
+
+  pthread_cond_destroy(&sweeper->wake);
+  pthread_mutex_destroy(&sweeper->lock);
+  return false;
+}
+
+static void joinThread(WrenSweeper* sweeper)
+{
+  pthread_join(sweeper->thread, NULL);
+  pthread_cond_destroy(&sweeper->wake);
+  pthread_mutex_destroy(&sweeper->lock);
+}
+
+#endif
+
+WrenSweeper* wrenNewSweeper(WrenVM* vm)
+{
+  WrenSweeper* sweeper = (WrenSweeper*)vm->config.reallocateFn(NULL,
+      sizeof(WrenSweeper), vm->config.userData);
+  sweeper->vm = vm;
+  sweeper->first = NULL;
+  sweeper->last = NULL;
+  sweeper->stopping = false;
+
+  if (startThread(sweeper)) return sweeper;
+
+  vm->config.reallocateFn(sweeper, 0, vm->config.userData);
+  return NULL;
+}
+
+void wrenSweeperFree(WrenSweeper* sweeper, Obj* first, Obj* last)
+{
+  wrenSetObjNext(last, NULL);
+
+  lockSweeper(sweeper);
+  if (sweeper->first == NULL)
+  {
+    sweeper->first = first;
+  }
+  else
+  {
+    wrenSetObjNext(sweeper->last, first);
+  }
+  sweeper->last = last;
+  wakeSweeper(sweeper);
+  unlockSweeper(sweeper);
+}
+
+void wrenFreeSweeper(WrenSweeper* sweeper)
+{
+  lockSweeper(sweeper);
+  sweeper->stopping = true;
+  wakeSweeper(sweeper);
+  unlockSweeper(sweeper);
+
+  joinThread(sweeper);
+
+  WrenVM* vm = sweeper->vm;
+  vm->config.reallocateFn(sweeper, 0, vm->config.userData);
+}
+
+#endif
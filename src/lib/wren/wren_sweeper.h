@@ -0,0 +1,31 @@
+#ifndef wren_sweeper_h
+#define wren_sweeper_h
+
+#include "wren_common.h"
+#include "wren_value.h"
+
+// The sweeper is a thread that frees the objects a garbage collection found to
+// be unreachable, so that freeing them, which is most of the cost of sweeping,
+// doesn't pause the program.
+//
+// Nothing else refers to those objects anymore, so the only thing the thread
+// shares with the VM is the host's allocator.
+#if WREN_BACKGROUND_SWEEP
+
+typedef struct sWrenSweeper WrenSweeper;
+
+// Starts a sweeper thread for [vm]. Returns NULL if the thread couldn't be
+// created, in which case objects should be freed right away.
+WrenSweeper* wrenNewSweeper(WrenVM* vm);
+
+// Hands the objects linked from [first] to [last] over to [sweeper] to free.
+// Their foreign finalizers must have been run already.
+void wrenSweeperFree(WrenSweeper* sweeper, Obj* first, Obj* last);
+
+// Frees the objects that have been handed over and not freed yet, then stops
+// the thread and frees [sweeper].
+void wrenFreeSweeper(WrenSweeper* sweeper);
+
+#endif
+
+#endif
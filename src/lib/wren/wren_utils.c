@@ -1,20 +1,69 @@
+// clock_gettime() is POSIX rather than standard C.
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <string.h>
 
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
 #include "wren_utils.h"
 #include "wren_vm.h"
 
 DEFINE_BUFFER(Byte, uint8_t);
 DEFINE_BUFFER(Int, int);
-DEFINE_BUFFER(String, ObjString*);
 
 void wrenSymbolTableInit(SymbolTable* symbols)
 {
-  wrenStringBufferInit(symbols);
+  symbols->data = NULL;
+  symbols->count = 0;
+  symbols->capacity = 0;
+  symbols->slots = NULL;
+  symbols->slotCapacity = 0;
 }
 
 void wrenSymbolTableClear(WrenVM* vm, SymbolTable* symbols)
 {
-  wrenStringBufferClear(vm, symbols);
+  wrenReallocate(vm, symbols->data, 0, 0);
+  wrenReallocate(vm, symbols->slots, 0, 0);
+  wrenSymbolTableInit(symbols);
+}
+
+// Generates the hash code of a name. This is the same FNV-1a hash strings use.
+static uint32_t hashName(const char* name, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+// Returns the slot in [symbols]' hash table where [name] is, or the empty slot
+// where it should go if it isn't there.
+static int* findSlot(const SymbolTable* symbols, const char* name,
+                     size_t length)
+{
+  uint32_t mask = (uint32_t)symbols->slotCapacity - 1;
+  uint32_t index = hashName(name, length) & mask;
+
+  // The table is never full, so this always ends at an empty slot.
+  while (symbols->slots[index] != 0)
+  {
+    ObjString* symbol = symbols->data[symbols->slots[index] - 1];
+    if (wrenStringEqualsCString(symbol, name, length)) break;
+
+    index = (index + 1) & mask;
+  }
+
+  return &symbols->slots[index];
 }
 
 int wrenSymbolTableAdd(WrenVM* vm, SymbolTable* symbols,
@@ -23,7 +72,39 @@ int wrenSymbolTableAdd(WrenVM* vm, SymbolTable* symbols,
   ObjString* symbol = AS_STRING(wrenNewStringLength(vm, name, length));
   
   wrenPushRoot(vm, &symbol->obj);
-  wrenStringBufferWrite(vm, symbols, symbol);
+
+  if (symbols->count >= symbols->capacity)
+  {
+    int capacity = wrenPowerOf2Ceil(symbols->count + 1);
+    symbols->data = (ObjString**)wrenReallocate(vm, symbols->data,
+        symbols->capacity * sizeof(ObjString*), capacity * sizeof(ObjString*));
+    symbols->capacity = capacity;
+  }
+
+  // Rebuild the hash table if it would get more than half full.
+  if ((symbols->count + 1) * 2 > symbols->slotCapacity)
+  {
+    int capacity = symbols->slotCapacity == 0 ? 16 : symbols->slotCapacity * 2;
+    int* slots = (int*)wrenReallocate(vm, NULL, 0, capacity * sizeof(int));
+    memset(slots, 0, capacity * sizeof(int));
+
+    wrenReallocate(vm, symbols->slots, 0, 0);
+    symbols->slots = slots;
+    symbols->slotCapacity = capacity;
+
+    for (int i = 0; i < symbols->count; i++)
+    {
+      ObjString* existing = symbols->data[i];
+      int* slot = findSlot(symbols, existing->value, existing->length);
+      if (*slot == 0) *slot = i + 1;
+    }
+  }
+
+  // If the name is already there, lookups keep finding the first one.
+  symbols->data[symbols->count++] = symbol;
+  int* slot = findSlot(symbols, name, length);
+  if (*slot == 0) *slot = symbols->count;
+
   wrenPopRoot(vm);
   
   return symbols->count - 1;
@@ -43,14 +124,9 @@ int wrenSymbolTableEnsure(WrenVM* vm, SymbolTable* symbols,
 int wrenSymbolTableFind(const SymbolTable* symbols,
                         const char* name, size_t length)
 {
-  // See if the symbol is already defined.
-  // TODO: O(n). Do something better.
-  for (int i = 0; i < symbols->count; i++)
-  {
-    if (wrenStringEqualsCString(symbols->data[i], name, length)) return i;
-  }
+  if (symbols->count == 0) return -1;
 
-  return -1;
+  return *findSlot(symbols, name, length) - 1;
 }
 
 void wrenBlackenSymbolTable(WrenVM* vm, SymbolTable* symbolTable)
@@ -61,7 +137,8 @@ void wrenBlackenSymbolTable(WrenVM* vm, SymbolTable* symbolTable)
   }
   
   // Keep track of how much memory is still in use.
-  vm->bytesAllocated += symbolTable->capacity * sizeof(*symbolTable->data);
+  vm->bytesAllocated += symbolTable->capacity * sizeof(*symbolTable->data) +
+                        symbolTable->slotCapacity * sizeof(int);
 }
 
 int wrenUtf8EncodeNumBytes(int value)
@@ -205,3 +282,18 @@ uint32_t wrenValidateIndex(uint32_t count, int64_t value)
 
   return UINT32_MAX;
 }
+
+double wrenWallClock()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
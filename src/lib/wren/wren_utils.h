@@ -65,10 +65,25 @@ typedef struct sObjString ObjString;
 
 DECLARE_BUFFER(Byte, uint8_t);
 DECLARE_BUFFER(Int, int);
-DECLARE_BUFFER(String, ObjString*);
 
-// TODO: Change this to use a map.
-typedef StringBuffer SymbolTable;
+// A list of unique names that hands out the index of each name in the list.
+//
+// Names are found through a hash table of indexes into [data], using open
+// addressing with linear probing, so that looking a name up doesn't depend on
+// how many others there are.
+typedef struct
+{
+  // The names, in the order they were added.
+  ObjString** data;
+  int count;
+  int capacity;
+
+  // The hash table. Each slot holds the index of a name plus one, or zero if
+  // it's empty. Its capacity is a power of two and is kept at least twice the
+  // number of names.
+  int* slots;
+  int slotCapacity;
+} SymbolTable;
 
 // Initializes the symbol table.
 void wrenSymbolTableInit(SymbolTable* symbols);
@@ -123,4 +138,10 @@ int wrenPowerOf2Ceil(int n);
 // index value. If invalid, returns `UINT32_MAX`.
 uint32_t wrenValidateIndex(uint32_t count, int64_t value);
 
+// Returns the time in seconds from a monotonic wall clock with an unspecified
+// starting point. Unlike clock(), this doesn't count the time spent by other
+// threads, such as the background sweeper, and means the same thing on every
+// platform.
+double wrenWallClock();
+
 #endif
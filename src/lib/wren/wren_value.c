@@ -7,7 +7,7 @@
 #include "wren_value.h"
 #include "wren_vm.h"
 
-#if WREN_DEBUG_TRACE_MEMORY
+#if WREN_DEBUG_TRACE_MEMORY || WREN_DEBUG_TRACK_ALLOCATIONS
   #include "wren_debug.h"
 #endif
 
@@ -32,15 +32,24 @@
 #define INITIAL_CALL_FRAMES 4
 
 DEFINE_BUFFER(Value, Value);
-DEFINE_BUFFER(Method, Method);
 
 static void initObj(WrenVM* vm, Obj* obj, ObjType type, ObjClass* classObj)
 {
-  obj->type = type;
-  obj->isDark = false;
+  ASSERT(((uintptr_t)obj & ~OBJ_NEXT_MASK) == 0,
+         "Object pointers must fit in 48 bits.");
+
   obj->classObj = classObj;
-  obj->next = vm->first;
+  obj->header = (uint64_t)type << OBJ_TYPE_SHIFT;
+  if (vm->slab != NULL && wrenSlabContains(vm->slab, obj))
+  {
+    obj->header |= OBJ_IN_PAGE;
+  }
+  wrenSetObjNext(obj, vm->first);
   vm->first = obj;
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  wrenTrackAllocation(vm, obj, vm->lastAllocationSize);
+#endif
 }
 
 ObjClass* wrenNewSingleClass(WrenVM* vm, int numFields, ObjString* name)
@@ -52,9 +61,9 @@ ObjClass* wrenNewSingleClass(WrenVM* vm, int numFields, ObjString* name)
   classObj->name = name;
   classObj->attributes = NULL_VAL;
 
-  wrenPushRoot(vm, (Obj*)classObj);
-  wrenMethodBufferInit(&classObj->methods);
-  wrenPopRoot(vm);
+  classObj->methods.pages = NULL;
+  classObj->methods.pageCount = 0;
+  classObj->methods.usedPages = 0;
 
   return classObj;
 }
@@ -77,9 +86,16 @@ void wrenBindSuperclass(WrenVM* vm, ObjClass* subclass, ObjClass* superclass)
   }
 
   // Inherit methods from its superclass.
-  for (int i = 0; i < superclass->methods.count; i++)
+  for (int page = 0; page < superclass->methods.pageCount; page++)
   {
-    wrenBindMethod(vm, subclass, i, superclass->methods.data[i]);
+    Method* methods = superclass->methods.pages[page];
+    if (methods == NULL) continue;
+
+    for (int i = 0; i < METHOD_PAGE_SIZE; i++)
+    {
+      if (methods[i].type == METHOD_NONE) continue;
+      wrenBindMethod(vm, subclass, (page << METHOD_PAGE_BITS) + i, methods[i]);
+    }
   }
 }
 
@@ -119,16 +135,41 @@ ObjClass* wrenNewClass(WrenVM* vm, ObjClass* superclass, int numFields,
 
 void wrenBindMethod(WrenVM* vm, ObjClass* classObj, int symbol, Method method)
 {
-  // Make sure the buffer is big enough to contain the symbol's index.
-  if (symbol >= classObj->methods.count)
+  // The interpreter's numeric fast paths assume Num's methods never change.
+  if (classObj == vm->numClass) vm->numOperatorsBuiltin = false;
+
+  MethodTable* table = &classObj->methods;
+  int page = symbol >> METHOD_PAGE_BITS;
+
+  // Make sure there is a page for the symbol's index.
+  if (page >= table->pageCount)
+  {
+    int pageCount = wrenPowerOf2Ceil(page + 1);
+    Method** pages = ALLOCATE_ARRAY(vm, Method*, pageCount);
+    for (int i = 0; i < pageCount; i++)
+    {
+      pages[i] = i < table->pageCount ? table->pages[i] : NULL;
+    }
+
+    DEALLOCATE(vm, table->pages);
+    table->pages = pages;
+    table->pageCount = pageCount;
+  }
+
+  if (table->pages[page] == NULL)
   {
-    Method noMethod;
-    noMethod.type = METHOD_NONE;
-    wrenMethodBufferFill(vm, &classObj->methods, noMethod,
-                         symbol - classObj->methods.count + 1);
+    Method* methods = ALLOCATE_ARRAY(vm, Method, METHOD_PAGE_SIZE);
+    for (int i = 0; i < METHOD_PAGE_SIZE; i++)
+    {
+      methods[i].type = METHOD_NONE;
+    }
+
+    table->pages[page] = methods;
+    table->usedPages++;
   }
 
-  classObj->methods.data[symbol] = method;
+  wrenWriteBarrier(vm, (Obj*)classObj);
+  table->pages[page][symbol & (METHOD_PAGE_SIZE - 1)] = method;
 }
 
 ObjClosure* wrenNewClosure(WrenVM* vm, ObjFn* fn)
@@ -257,6 +298,11 @@ ObjFn* wrenNewFunction(WrenVM* vm, ObjModule* module, int maxSlots)
   fn->numUpvalues = 0;
   fn->arity = 0;
   fn->debug = debug;
+  fn->callCaches = NULL;
+  fn->numCallCaches = 0;
+#if WREN_DEBUG_COUNT_EXECUTION
+  fn->executionCount = 0;
+#endif
   
   return fn;
 }
@@ -268,6 +314,21 @@ void wrenFunctionBindName(WrenVM* vm, ObjFn* fn, const char* name, int length)
   fn->debug->name[length] = '\0';
 }
 
+void wrenFunctionInitCallCaches(WrenVM* vm, ObjFn* fn, int count)
+{
+  if (count == 0) return;
+
+  CallCache* caches = ALLOCATE_ARRAY(vm, CallCache, count);
+  for (int i = 0; i < count; i++)
+  {
+    caches[i].classObj = NULL;
+    caches[i].method = NULL;
+  }
+
+  fn->callCaches = caches;
+  fn->numCallCaches = count;
+}
+
 Value wrenNewInstance(WrenVM* vm, ObjClass* classObj)
 {
   ObjInstance* instance = ALLOCATE_FLEX(vm, ObjInstance,
@@ -303,6 +364,8 @@ ObjList* wrenNewList(WrenVM* vm, uint32_t numElements)
 
 void wrenListInsert(WrenVM* vm, ObjList* list, Value value, uint32_t index)
 {
+  wrenWriteBarrier(vm, (Obj*)list);
+
   if (IS_OBJ(value)) wrenPushRoot(vm, AS_OBJ(value));
 
   // Add a slot at the end of the list.
@@ -370,6 +433,19 @@ ObjMap* wrenNewMap(WrenVM* vm)
   return map;
 }
 
+ObjMap* wrenNewWeakMap(WrenVM* vm)
+{
+  ObjMap* map = wrenNewMap(vm);
+  map->obj.classObj = vm->weakMapClass;
+  return map;
+}
+
+bool wrenIsWeakMap(WrenVM* vm, ObjMap* map)
+{
+  // Maps made while the core module is loaded have no class yet.
+  return vm->weakMapClass != NULL && map->obj.classObj == vm->weakMapClass;
+}
+
 static inline uint32_t hashBits(uint64_t hash)
 {
   // From v8's ComputeLongHash() which in turn cites:
@@ -394,7 +470,7 @@ static inline uint32_t hashNumber(double num)
 // Generates a hash code for [object].
 static uint32_t hashObject(Obj* object)
 {
-  switch (object->type)
+  switch (wrenObjType(object))
   {
     case OBJ_CLASS:
       // Classes just use their name.
@@ -420,8 +496,9 @@ static uint32_t hashObject(Obj* object)
       return ((ObjString*)object)->hash;
 
     default:
-      ASSERT(false, "Only immutable objects can be hashed.");
-      return 0;
+      // Other objects can only be the keys of weak maps, which compare them by
+      // identity.
+      return hashBits((uint64_t)(uintptr_t)object);
   }
 }
 
@@ -581,6 +658,8 @@ Value wrenMapGet(ObjMap* map, Value key)
 
 void wrenMapSet(WrenVM* vm, ObjMap* map, Value key, Value value)
 {
+  wrenWriteBarrier(vm, (Obj*)map);
+
   // If the map is getting too full, make room first.
   if (map->count + 1 > map->capacity * MAP_LOAD_PERCENT / 100)
   {
@@ -671,6 +750,53 @@ Value wrenNewRange(WrenVM* vm, double from, double to, bool isInclusive)
   return OBJ_VAL(range);
 }
 
+ObjStringBuilder* wrenNewStringBuilder(WrenVM* vm)
+{
+  ObjStringBuilder* builder = ALLOCATE(vm, ObjStringBuilder);
+  initObj(vm, &builder->obj, OBJ_STRING_BUILDER, vm->stringBuilderClass);
+  wrenByteBufferInit(&builder->bytes);
+  return builder;
+}
+
+void wrenStringBuilderInsert(WrenVM* vm, ObjStringBuilder* builder,
+                             uint32_t index, const char* bytes,
+                             uint32_t length)
+{
+  ByteBuffer* buffer = &builder->bytes;
+
+  // Leave room for the null terminator.
+  uint32_t count = (uint32_t)buffer->count + length;
+  if ((uint32_t)buffer->capacity < count + 1)
+  {
+    int capacity = wrenPowerOf2Ceil(count + 1);
+    buffer->data = (uint8_t*)wrenReallocate(vm, buffer->data,
+                                            buffer->capacity, capacity);
+    buffer->capacity = capacity;
+  }
+
+  memmove(buffer->data + index + length, buffer->data + index,
+          buffer->count - index);
+  memcpy(buffer->data + index, bytes, length);
+  buffer->count = count;
+  buffer->data[count] = '\0';
+}
+
+Value wrenStringBuilderToString(WrenVM* vm, ObjStringBuilder* builder)
+{
+  if (builder->bytes.count == 0) return CONST_STRING(vm, "");
+
+  return wrenNewStringLength(vm, (const char*)builder->bytes.data,
+                             builder->bytes.count);
+}
+
+ObjWeakRef* wrenNewWeakRef(WrenVM* vm, Obj* target)
+{
+  ObjWeakRef* weakRef = ALLOCATE(vm, ObjWeakRef);
+  initObj(vm, &weakRef->obj, OBJ_WEAK_REF, vm->weakRefClass);
+  weakRef->target = target;
+  return weakRef;
+}
+
 // Creates a new string object with a null-terminated buffer large enough to
 // hold a string of [length] but does not fill in the bytes.
 //
@@ -728,6 +854,12 @@ Value wrenNewStringLength(WrenVM* vm, const char* text, size_t length)
 Value wrenNewStringFromRange(WrenVM* vm, ObjString* source, int start,
                              uint32_t count, int step)
 {
+  // The whole string is the string itself, so there's nothing to copy.
+  if (start == 0 && count == source->length && step == 1)
+  {
+    return OBJ_VAL(source);
+  }
+
   uint8_t* from = (uint8_t*)source->value;
   int length = 0;
   for (uint32_t i = 0; i < count; i++)
@@ -880,6 +1012,80 @@ Value wrenStringFormat(WrenVM* vm, const char* format, ...)
   return OBJ_VAL(result);
 }
 
+Value wrenStringJoin(WrenVM* vm, const Value* strings, uint32_t count,
+                     ObjString* separator)
+{
+  size_t separatorLength = separator == NULL ? 0 : separator->length;
+
+  size_t totalLength = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    totalLength += AS_STRING(strings[i])->length;
+  }
+  if (count > 1) totalLength += separatorLength * (count - 1);
+
+  ObjString* result = allocateString(vm, totalLength);
+
+  char* start = result->value;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (i > 0 && separatorLength > 0)
+    {
+      memcpy(start, separator->value, separatorLength);
+      start += separatorLength;
+    }
+
+    ObjString* string = AS_STRING(strings[i]);
+    memcpy(start, string->value, string->length);
+    start += string->length;
+  }
+
+  hashString(result);
+
+  return OBJ_VAL(result);
+}
+
+Value wrenStringReplace(WrenVM* vm, ObjString* string, ObjString* from,
+                        ObjString* to)
+{
+  ASSERT(from->length > 0, "Cannot replace an empty string.");
+
+  // Count the matches first so that the result can be allocated at its final
+  // size.
+  uint32_t count = 0;
+  for (uint32_t index = wrenStringFind(string, from, 0);
+       index != UINT32_MAX;
+       index = wrenStringFind(string, from, index + from->length))
+  {
+    count++;
+  }
+
+  // Strings are immutable, so if nothing changes the string is the result.
+  if (count == 0) return OBJ_VAL(string);
+
+  size_t length = string->length - (size_t)count * from->length +
+                  (size_t)count * to->length;
+  ObjString* result = allocateString(vm, length);
+
+  char* start = result->value;
+  uint32_t last = 0;
+  for (uint32_t index = wrenStringFind(string, from, 0);
+       index != UINT32_MAX;
+       index = wrenStringFind(string, from, last))
+  {
+    memcpy(start, string->value + last, index - last);
+    start += index - last;
+    memcpy(start, to->value, to->length);
+    start += to->length;
+    last = index + from->length;
+  }
+  memcpy(start, string->value + last, string->length - last);
+
+  hashString(result);
+
+  return OBJ_VAL(result);
+}
+
 Value wrenStringCodePointAt(WrenVM* vm, ObjString* string, uint32_t index)
 {
   ASSERT(index < string->length, "Index out of bounds.");
@@ -898,7 +1104,7 @@ Value wrenStringCodePointAt(WrenVM* vm, ObjString* string, uint32_t index)
   return wrenStringFromCodePoint(vm, codePoint);
 }
 
-// Uses the Boyer-Moore-Horspool string matching algorithm.
+// Uses the Boyer-Moore-Horspool string matching algorithm for long needles.
 uint32_t wrenStringFind(ObjString* haystack, ObjString* needle, uint32_t start)
 {
   // Edge case: An empty needle is always found.
@@ -910,17 +1116,37 @@ uint32_t wrenStringFind(ObjString* haystack, ObjString* needle, uint32_t start)
   // If the startIndex is too far it also won't be found.
   if (start >= haystack->length) return UINT32_MAX;
 
+  // Short needles, like the separators that strings are split on, are found
+  // faster by letting memchr() look for their first byte than by building the
+  // shift table below on every search.
+  if (needle->length < 8)
+  {
+    const char* end = haystack->value + haystack->length - needle->length + 1;
+    const char* c = haystack->value + start;
+    while ((c = memchr(c, needle->value[0], end - c)) != NULL)
+    {
+      if (memcmp(c + 1, needle->value + 1, needle->length - 1) == 0)
+      {
+        return (uint32_t)(c - haystack->value);
+      }
+
+      c++;
+    }
+
+    return UINT32_MAX;
+  }
+
   // Pre-calculate the shift table. For each character (8-bit value), we
   // determine how far the search window can be advanced if that character is
   // the last character in the haystack where we are searching for the needle
   // and the needle doesn't match there.
-  uint32_t shift[UINT8_MAX];
+  uint32_t shift[UINT8_MAX + 1];
   uint32_t needleEnd = needle->length - 1;
 
   // By default, we assume the character is not the needle at all. In that case
   // case, if a match fails on that character, we can advance one whole needle
   // width since.
-  for (uint32_t index = 0; index < UINT8_MAX; index++)
+  for (uint32_t index = 0; index <= UINT8_MAX; index++)
   {
     shift[index] = needle->length;
   }
@@ -973,18 +1199,10 @@ ObjUpvalue* wrenNewUpvalue(WrenVM* vm, Value* value)
   return upvalue;
 }
 
-void wrenGrayObj(WrenVM* vm, Obj* obj)
+static void pushGray(WrenVM* vm, Obj* obj)
 {
-  if (obj == NULL) return;
-
-  // Stop if the object is already darkened so we don't get stuck in a cycle.
-  if (obj->isDark) return;
+  wrenSetGray(obj, true);
 
-  // It's been reached.
-  obj->isDark = true;
-
-  // Add it to the gray list so it can be recursively explored for
-  // more marks later.
   if (vm->grayCount >= vm->grayCapacity)
   {
     vm->grayCapacity = vm->grayCount * 2;
@@ -996,6 +1214,32 @@ void wrenGrayObj(WrenVM* vm, Obj* obj)
   vm->gray[vm->grayCount++] = obj;
 }
 
+void wrenGrayObj(WrenVM* vm, Obj* obj)
+{
+  if (obj == NULL) return;
+
+  // Stop if the object is already darkened so we don't get stuck in a cycle.
+  if (wrenIsDark(obj)) return;
+
+  // It's been reached.
+  wrenSetDark(obj, true);
+
+  // Add it to the gray list so it can be recursively explored for
+  // more marks later.
+  pushGray(vm, obj);
+}
+
+void wrenRegrayObj(WrenVM* vm, Obj* obj)
+{
+  if (wrenIsGray(obj)) return;
+
+  // It will be counted again when it's blackened.
+  size_t size = wrenObjectSize(obj);
+  vm->bytesMarked = vm->bytesMarked > size ? vm->bytesMarked - size : 0;
+
+  pushGray(vm, obj);
+}
+
 void wrenGrayValue(WrenVM* vm, Value value)
 {
   if (!IS_OBJ(value)) return;
@@ -1019,21 +1263,23 @@ static void blackenClass(WrenVM* vm, ObjClass* classObj)
   wrenGrayObj(vm, (Obj*)classObj->superclass);
 
   // Method function objects.
-  for (int i = 0; i < classObj->methods.count; i++)
+  for (int page = 0; page < classObj->methods.pageCount; page++)
   {
-    if (classObj->methods.data[i].type == METHOD_BLOCK)
+    Method* methods = classObj->methods.pages[page];
+    if (methods == NULL) continue;
+
+    for (int i = 0; i < METHOD_PAGE_SIZE; i++)
     {
-      wrenGrayObj(vm, (Obj*)classObj->methods.data[i].as.closure);
+      if (methods[i].type == METHOD_BLOCK)
+      {
+        wrenGrayObj(vm, (Obj*)methods[i].as.closure);
+      }
     }
   }
 
   wrenGrayObj(vm, (Obj*)classObj->name);
 
   if(!IS_NULL(classObj->attributes)) wrenGrayObj(vm, AS_OBJ(classObj->attributes));
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjClass);
-  vm->bytesAllocated += classObj->methods.capacity * sizeof(Method);
 }
 
 static void blackenClosure(WrenVM* vm, ObjClosure* closure)
@@ -1046,10 +1292,6 @@ static void blackenClosure(WrenVM* vm, ObjClosure* closure)
   {
     wrenGrayObj(vm, (Obj*)closure->upvalues[i]);
   }
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjClosure);
-  vm->bytesAllocated += sizeof(ObjUpvalue*) * closure->fn->numUpvalues;
 }
 
 static void blackenFiber(WrenVM* vm, ObjFiber* fiber)
@@ -1077,11 +1319,6 @@ static void blackenFiber(WrenVM* vm, ObjFiber* fiber)
   // The caller.
   wrenGrayObj(vm, (Obj*)fiber->caller);
   wrenGrayValue(vm, fiber->error);
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjFiber);
-  vm->bytesAllocated += fiber->frameCapacity * sizeof(CallFrame);
-  vm->bytesAllocated += fiber->stackCapacity * sizeof(Value);
 }
 
 static void blackenFn(WrenVM* vm, ObjFn* fn)
@@ -1092,23 +1329,11 @@ static void blackenFn(WrenVM* vm, ObjFn* fn)
   // Mark the module it belongs to, in case it's been unloaded.
   wrenGrayObj(vm, (Obj*)fn->module);
 
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjFn);
-  vm->bytesAllocated += sizeof(uint8_t) * fn->code.capacity;
-  vm->bytesAllocated += sizeof(Value) * fn->constants.capacity;
-  
-  // The debug line number buffer.
-  vm->bytesAllocated += sizeof(int) * fn->code.capacity;
-  // TODO: What about the function name?
-}
-
-static void blackenForeign(WrenVM* vm, ObjForeign* foreign)
-{
-  // TODO: Keep track of how much memory the foreign object uses. We can store
-  // this in each foreign object, but it will balloon the size. We may not want
-  // that much overhead. One option would be to let the foreign class register
-  // a C function that returns a size for the object. That way the VM doesn't
-  // always have to explicitly store it.
+  // Mark the classes the calls are cached for.
+  for (int i = 0; i < fn->numCallCaches; i++)
+  {
+    wrenGrayObj(vm, (Obj*)fn->callCaches[i].classObj);
+  }
 }
 
 static void blackenInstance(WrenVM* vm, ObjInstance* instance)
@@ -1120,24 +1345,38 @@ static void blackenInstance(WrenVM* vm, ObjInstance* instance)
   {
     wrenGrayValue(vm, instance->fields[i]);
   }
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjInstance);
-  vm->bytesAllocated += sizeof(Value) * instance->obj.classObj->numFields;
 }
 
 static void blackenList(WrenVM* vm, ObjList* list)
 {
   // Mark the elements.
   wrenGrayBuffer(vm, &list->elements);
+}
 
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjList);
-  vm->bytesAllocated += sizeof(Value) * list->elements.capacity;
+// Remembers [obj], a weak reference or weak map, so that what it only holds
+// weakly can be dealt with once marking is done.
+static void pushWeak(WrenVM* vm, Obj* obj)
+{
+  if (vm->weakCount >= vm->weakCapacity)
+  {
+    vm->weakCapacity = vm->weakCapacity == 0 ? 4 : vm->weakCapacity * 2;
+    vm->weak = (Obj**)vm->config.reallocateFn(vm->weak,
+        vm->weakCapacity * sizeof(Obj*), vm->config.userData);
+  }
+
+  vm->weak[vm->weakCount++] = obj;
 }
 
 static void blackenMap(WrenVM* vm, ObjMap* map)
 {
+  // The entries of a weak map are only marked once it's known which keys are
+  // reachable.
+  if (wrenIsWeakMap(vm, map))
+  {
+    pushWeak(vm, (Obj*)map);
+    return;
+  }
+
   // Mark the entries.
   for (uint32_t i = 0; i < map->capacity; i++)
   {
@@ -1147,10 +1386,6 @@ static void blackenMap(WrenVM* vm, ObjMap* map)
     wrenGrayValue(vm, entry->key);
     wrenGrayValue(vm, entry->value);
   }
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjMap);
-  vm->bytesAllocated += sizeof(MapEntry) * map->capacity;
 }
 
 static void blackenModule(WrenVM* vm, ObjModule* module)
@@ -1164,30 +1399,90 @@ static void blackenModule(WrenVM* vm, ObjModule* module)
   wrenBlackenSymbolTable(vm, &module->variableNames);
 
   wrenGrayObj(vm, (Obj*)module->name);
-
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjModule);
 }
 
-static void blackenRange(WrenVM* vm, ObjRange* range)
+static void blackenUpvalue(WrenVM* vm, ObjUpvalue* upvalue)
 {
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjRange);
+  // Mark the closed-over object (in case it is closed).
+  wrenGrayValue(vm, upvalue->closed);
 }
 
-static void blackenString(WrenVM* vm, ObjString* string)
+static void blackenWeakRef(WrenVM* vm, ObjWeakRef* weakRef)
 {
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjString) + string->length + 1;
+  // The target is not marked, only checked once marking is done.
+  pushWeak(vm, (Obj*)weakRef);
 }
 
-static void blackenUpvalue(WrenVM* vm, ObjUpvalue* upvalue)
+size_t wrenObjectSize(Obj* obj)
 {
-  // Mark the closed-over object (in case it is closed).
-  wrenGrayValue(vm, upvalue->closed);
+  switch (wrenObjType(obj))
+  {
+    case OBJ_CLASS:
+    {
+      ObjClass* classObj = (ObjClass*)obj;
+      return sizeof(ObjClass) +
+             classObj->methods.pageCount * sizeof(Method*) +
+             classObj->methods.usedPages * METHOD_PAGE_SIZE * sizeof(Method);
+    }
 
-  // Keep track of how much memory is still in use.
-  vm->bytesAllocated += sizeof(ObjUpvalue);
+    case OBJ_CLOSURE:
+    {
+      ObjClosure* closure = (ObjClosure*)obj;
+      return sizeof(ObjClosure) +
+             sizeof(ObjUpvalue*) * closure->fn->numUpvalues;
+    }
+
+    case OBJ_FIBER:
+    {
+      ObjFiber* fiber = (ObjFiber*)obj;
+      return sizeof(ObjFiber) +
+             fiber->frameCapacity * sizeof(CallFrame) +
+             fiber->stackCapacity * sizeof(Value);
+    }
+
+    case OBJ_FN:
+    {
+      // The code and the debug line number buffer have the same capacity.
+      // TODO: What about the function name?
+      ObjFn* fn = (ObjFn*)obj;
+      return sizeof(ObjFn) +
+             sizeof(uint8_t) * fn->code.capacity +
+             sizeof(Value) * fn->constants.capacity +
+             sizeof(int) * fn->code.capacity +
+             sizeof(CallCache) * fn->numCallCaches;
+    }
+
+    case OBJ_FOREIGN:
+      // TODO: Keep track of how much memory the foreign object uses. We can
+      // store this in each foreign object, but it will balloon the size. We may
+      // not want that much overhead. One option would be to let the foreign
+      // class register a C function that returns a size for the object. That
+      // way the VM doesn't always have to explicitly store it.
+      return sizeof(ObjForeign);
+
+    case OBJ_INSTANCE:
+      return sizeof(ObjInstance) +
+             sizeof(Value) * obj->classObj->numFields;
+
+    case OBJ_LIST:
+      return sizeof(ObjList) +
+             sizeof(Value) * ((ObjList*)obj)->elements.capacity;
+
+    case OBJ_MAP:
+      return sizeof(ObjMap) + sizeof(MapEntry) * ((ObjMap*)obj)->capacity;
+
+    case OBJ_MODULE:  return sizeof(ObjModule);
+    case OBJ_RANGE:   return sizeof(ObjRange);
+    case OBJ_STRING:  return sizeof(ObjString) + ((ObjString*)obj)->length + 1;
+    case OBJ_STRING_BUILDER:
+      return sizeof(ObjStringBuilder) +
+             ((ObjStringBuilder*)obj)->bytes.capacity;
+    case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+    case OBJ_WEAK_REF: return sizeof(ObjWeakRef);
+  }
+
+  UNREACHABLE();
+  return 0;
 }
 
 static void blackenObject(WrenVM* vm, Obj* obj)
@@ -1198,22 +1493,29 @@ static void blackenObject(WrenVM* vm, Obj* obj)
   printf(" @ %p\n", obj);
 #endif
 
+  wrenSetGray(obj, false);
+
   // Traverse the object's fields.
-  switch (obj->type)
+  switch (wrenObjType(obj))
   {
     case OBJ_CLASS:    blackenClass(   vm, (ObjClass*)   obj); break;
     case OBJ_CLOSURE:  blackenClosure( vm, (ObjClosure*) obj); break;
     case OBJ_FIBER:    blackenFiber(   vm, (ObjFiber*)   obj); break;
     case OBJ_FN:       blackenFn(      vm, (ObjFn*)      obj); break;
-    case OBJ_FOREIGN:  blackenForeign( vm, (ObjForeign*) obj); break;
+    case OBJ_FOREIGN:  break;
     case OBJ_INSTANCE: blackenInstance(vm, (ObjInstance*)obj); break;
     case OBJ_LIST:     blackenList(    vm, (ObjList*)    obj); break;
     case OBJ_MAP:      blackenMap(     vm, (ObjMap*)     obj); break;
     case OBJ_MODULE:   blackenModule(  vm, (ObjModule*)  obj); break;
-    case OBJ_RANGE:    blackenRange(   vm, (ObjRange*)   obj); break;
-    case OBJ_STRING:   blackenString(  vm, (ObjString*)  obj); break;
+    case OBJ_RANGE:    break;
+    case OBJ_STRING:   break;
+    case OBJ_STRING_BUILDER: break;
     case OBJ_UPVALUE:  blackenUpvalue( vm, (ObjUpvalue*) obj); break;
+    case OBJ_WEAK_REF: blackenWeakRef( vm, (ObjWeakRef*) obj); break;
   }
+
+  // Keep track of how much memory is still in use.
+  vm->bytesMarked += wrenObjectSize(obj);
 }
 
 void wrenBlackenObjects(WrenVM* vm)
@@ -1226,6 +1528,89 @@ void wrenBlackenObjects(WrenVM* vm)
   }
 }
 
+int wrenBlackenSomeObjects(WrenVM* vm, int limit)
+{
+  int count = 0;
+  while (vm->grayCount > 0 && count < limit)
+  {
+    Obj* obj = vm->gray[--vm->grayCount];
+    blackenObject(vm, obj);
+    count++;
+
+    if (wrenObjType(obj) != OBJ_FIBER) continue;
+
+    if (vm->grayAgainCount >= vm->grayAgainCapacity)
+    {
+      vm->grayAgainCapacity = vm->grayAgainCapacity == 0
+          ? 4 : vm->grayAgainCapacity * 2;
+      vm->grayAgain = (Obj**)vm->config.reallocateFn(vm->grayAgain,
+          vm->grayAgainCapacity * sizeof(Obj*), vm->config.userData);
+    }
+
+    vm->grayAgain[vm->grayAgainCount++] = obj;
+  }
+
+  return count;
+}
+
+void wrenClearWeakReferences(WrenVM* vm)
+{
+  // A weak map keeps the value of an entry alive as long as its key is. Since
+  // marking the values may reach more keys, keep going until no more are.
+  bool marked;
+  do
+  {
+    marked = false;
+    for (int i = 0; i < vm->weakCount; i++)
+    {
+      if (wrenObjType(vm->weak[i]) != OBJ_MAP) continue;
+
+      ObjMap* map = (ObjMap*)vm->weak[i];
+      for (uint32_t j = 0; j < map->capacity; j++)
+      {
+        MapEntry* entry = &map->entries[j];
+        if (IS_UNDEFINED(entry->key) || !wrenIsDark(AS_OBJ(entry->key))) continue;
+        if (!IS_OBJ(entry->value) || wrenIsDark(AS_OBJ(entry->value))) continue;
+
+        wrenGrayObj(vm, AS_OBJ(entry->value));
+        marked = true;
+      }
+    }
+
+    wrenBlackenObjects(vm);
+  }
+  while (marked);
+
+  // Whatever is still white now is garbage, so forget about it.
+  for (int i = 0; i < vm->weakCount; i++)
+  {
+    if (wrenObjType(vm->weak[i]) == OBJ_WEAK_REF)
+    {
+      ObjWeakRef* weakRef = (ObjWeakRef*)vm->weak[i];
+      if (weakRef->target != NULL && !wrenIsDark(weakRef->target))
+      {
+        weakRef->target = NULL;
+      }
+      continue;
+    }
+
+    // Turn the entries into tombstones. The entry array is left as it is so
+    // that nothing is allocated during the collection.
+    ObjMap* map = (ObjMap*)vm->weak[i];
+    for (uint32_t j = 0; j < map->capacity; j++)
+    {
+      MapEntry* entry = &map->entries[j];
+      if (IS_UNDEFINED(entry->key) || wrenIsDark(AS_OBJ(entry->key))) continue;
+
+      entry->key = UNDEFINED_VAL;
+      entry->value = TRUE_VAL;
+      map->count--;
+    }
+  }
+
+  vm->weakCount = 0;
+}
+
 void wrenFreeObj(WrenVM* vm, Obj* obj)
 {
 #if WREN_DEBUG_TRACE_MEMORY
@@ -1234,11 +1619,18 @@ void wrenFreeObj(WrenVM* vm, Obj* obj)
   printf(" @ %p\n", obj);
 #endif
 
-  switch (obj->type)
+  switch (wrenObjType(obj))
   {
     case OBJ_CLASS:
-      wrenMethodBufferClear(vm, &((ObjClass*)obj)->methods);
+    {
+      MethodTable* table = &((ObjClass*)obj)->methods;
+      for (int i = 0; i < table->pageCount; i++)
+      {
+        DEALLOCATE(vm, table->pages[i]);
+      }
+      DEALLOCATE(vm, table->pages);
       break;
+    }
 
     case OBJ_FIBER:
     {
@@ -1256,13 +1648,10 @@ void wrenFreeObj(WrenVM* vm, Obj* obj)
       wrenIntBufferClear(vm, &fn->debug->sourceLines);
       DEALLOCATE(vm, fn->debug->name);
       DEALLOCATE(vm, fn->debug);
+      DEALLOCATE(vm, fn->callCaches);
       break;
     }
 
-    case OBJ_FOREIGN:
-      wrenFinalizeForeign(vm, (ObjForeign*)obj);
-      break;
-
     case OBJ_LIST:
       wrenValueBufferClear(vm, &((ObjList*)obj)->elements);
       break;
@@ -1276,11 +1665,17 @@ void wrenFreeObj(WrenVM* vm, Obj* obj)
       wrenValueBufferClear(vm, &((ObjModule*)obj)->variables);
       break;
 
+    case OBJ_STRING_BUILDER:
+      wrenByteBufferClear(vm, &((ObjStringBuilder*)obj)->bytes);
+      break;
+
     case OBJ_CLOSURE:
+    case OBJ_FOREIGN:
     case OBJ_INSTANCE:
     case OBJ_RANGE:
     case OBJ_STRING:
     case OBJ_UPVALUE:
+    case OBJ_WEAK_REF:
       break;
   }
 
@@ -1304,9 +1699,9 @@ bool wrenValuesEqual(Value a, Value b)
   Obj* bObj = AS_OBJ(b);
 
   // Must be the same type.
-  if (aObj->type != bObj->type) return false;
+  if (wrenObjType(aObj) != wrenObjType(bObj)) return false;
 
-  switch (aObj->type)
+  switch (wrenObjType(aObj))
   {
     case OBJ_RANGE:
     {
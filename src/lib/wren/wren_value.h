@@ -6,6 +6,7 @@
 
 #include "wren_common.h"
 #include "wren_math.h"
+#include "wren_slab.h"
 #include "wren_utils.h"
 
 // This defines the built-in types and their core representations in memory.
@@ -58,6 +59,8 @@
 #define AS_NUM(value)       (wrenValueToNum(value))             // double
 #define AS_RANGE(v)         ((ObjRange*)AS_OBJ(v))              // ObjRange*
 #define AS_STRING(v)        ((ObjString*)AS_OBJ(v))             // ObjString*
+#define AS_STRING_BUILDER(v) ((ObjStringBuilder*)AS_OBJ(v))     // ObjStringBuilder*
+#define AS_WEAK_REF(v)      ((ObjWeakRef*)AS_OBJ(v))            // ObjWeakRef*
 #define AS_CSTRING(v)       (AS_STRING(v)->value)               // const char*
 
 // These macros promote a primitive C value to a full Wren Value. There are
@@ -80,6 +83,8 @@
 #define IS_MAP(value) (wrenIsObjType(value, OBJ_MAP))           // ObjMap
 #define IS_RANGE(value) (wrenIsObjType(value, OBJ_RANGE))       // ObjRange
 #define IS_STRING(value) (wrenIsObjType(value, OBJ_STRING))     // ObjString
+#define IS_STRING_BUILDER(value) (wrenIsObjType(value, OBJ_STRING_BUILDER))
+#define IS_WEAK_REF(value) (wrenIsObjType(value, OBJ_WEAK_REF)) // ObjWeakRef
 
 // Creates a new string object from [text], which should be a bare C string
 // literal. This determines the length of the string automatically at compile
@@ -99,25 +104,103 @@ typedef enum {
   OBJ_MODULE,
   OBJ_RANGE,
   OBJ_STRING,
-  OBJ_UPVALUE
+  OBJ_STRING_BUILDER,
+  OBJ_UPVALUE,
+  OBJ_WEAK_REF
 } ObjType;
 
 typedef struct sObjClass ObjClass;
 
+// The low bits of an object's [header] hold the pointer to the next object.
+// Like NaN tagging, this relies on pointers only using the low 48 bits.
+#define OBJ_NEXT_MASK (((uint64_t)1 << 48) - 1)
+
+// The object's ObjType is stored in the 8 bits above the next pointer.
+#define OBJ_TYPE_SHIFT 48
+
+// The garbage collector's flags, in the top bits of the header.
+//
+// Objects allocated from the slab allocator's pages keep their marks in the
+// page's bitmaps instead of [OBJ_DARK] and [OBJ_GRAY], and have [OBJ_IN_PAGE]
+// set.
+#define OBJ_DARK    ((uint64_t)1 << 56)
+#define OBJ_GRAY    ((uint64_t)1 << 57)
+#define OBJ_IN_PAGE ((uint64_t)1 << 58)
+
 // Base struct for all heap-allocated objects.
 typedef struct sObj Obj;
 struct sObj
 {
-  ObjType type;
-  bool isDark;
-
   // The object's class.
   ObjClass* classObj;
 
-  // The next object in the linked list of all currently allocated objects.
-  struct sObj* next;
+  // The next object in the linked list of all currently allocated objects,
+  // with the object's type and garbage collector flags packed in above it.
+  // Use the functions below to access these.
+  uint64_t header;
 };
 
+static inline ObjType wrenObjType(const Obj* obj)
+{
+  return (ObjType)((obj->header >> OBJ_TYPE_SHIFT) & 0xff);
+}
+
+static inline Obj* wrenObjNext(const Obj* obj)
+{
+  return (Obj*)(uintptr_t)(obj->header & OBJ_NEXT_MASK);
+}
+
+static inline void wrenSetObjNext(Obj* obj, Obj* next)
+{
+  obj->header = (obj->header & ~OBJ_NEXT_MASK) | (uint64_t)(uintptr_t)next;
+}
+
+// Whether the garbage collector has reached [obj].
+static inline bool wrenIsDark(const Obj* obj)
+{
+  if (obj->header & OBJ_IN_PAGE) return wrenSlabGetBit(obj, WREN_SLAB_MARKS);
+  return (obj->header & OBJ_DARK) != 0;
+}
+
+static inline void wrenSetDark(Obj* obj, bool isDark)
+{
+  if (obj->header & OBJ_IN_PAGE)
+  {
+    wrenSlabSetBit(obj, WREN_SLAB_MARKS, isDark);
+  }
+  else if (isDark)
+  {
+    obj->header |= OBJ_DARK;
+  }
+  else
+  {
+    obj->header &= ~OBJ_DARK;
+  }
+}
+
+// Whether [obj] is on the gray stack waiting to be traced.
+static inline bool wrenIsGray(const Obj* obj)
+{
+  if (obj->header & OBJ_IN_PAGE) return wrenSlabGetBit(obj, WREN_SLAB_GRAYS);
+  return (obj->header & OBJ_GRAY) != 0;
+}
+
+static inline void wrenSetGray(Obj* obj, bool isGray)
+{
+  if (obj->header & OBJ_IN_PAGE)
+  {
+    wrenSlabSetBit(obj, WREN_SLAB_GRAYS, isGray);
+  }
+  else if (isGray)
+  {
+    obj->header |= OBJ_GRAY;
+  }
+  else
+  {
+    obj->header &= ~OBJ_GRAY;
+  }
+}
+
 #if WREN_NAN_TAGGING
 
 typedef uint64_t Value;
@@ -163,6 +246,18 @@ struct sObjString
   char value[FLEXIBLE_ARRAY];
 };
 
+// A mutable buffer of bytes for building up a string a piece at a time.
+//
+// [bytes] grows geometrically, so adding to the end takes amortized constant
+// time. Unless it is still empty, it always has room for a null terminator
+// after its [count] bytes.
+typedef struct
+{
+  Obj obj;
+
+  ByteBuffer bytes;
+} ObjStringBuilder;
+
 // The dynamically allocated data structure for a variable that has been used
 // by a closure. Whenever a function accesses a variable declared in an
 // enclosing function, it will get to it through this.
@@ -236,6 +331,21 @@ typedef struct
   ObjString* name;
 } ObjModule;
 
+typedef struct sMethod Method;
+
+// The inline cache of one method call in a function. It remembers the class of
+// the receiver the call was last made on and the method that was found for it,
+// so that a call on an instance of the same class again doesn't have to look
+// the method up.
+//
+// The cached class is kept alive by the function, so that another class can't
+// be allocated at the same address and be mistaken for it.
+typedef struct
+{
+  ObjClass* classObj;
+  Method* method;
+} CallCache;
+
 // A function object. It wraps and owns the bytecode and other debug information
 // for a callable chunk of code.
 //
@@ -265,6 +375,16 @@ typedef struct
   // only be set for fns, and not ObjFns that represent methods or scripts.
   int arity;
   FnDebug* debug;
+
+  // The inline caches of the calls in the bytecode, indexed by the last
+  // argument of the call instructions.
+  CallCache* callCaches;
+  int numCallCaches;
+
+#if WREN_DEBUG_COUNT_EXECUTION
+  // The number of instructions executed in this function.
+  uint64_t executionCount;
+#endif
 } ObjFn;
 
 // An instance of a first-class function and the environment it has closed over.
@@ -368,12 +488,21 @@ typedef enum
 
   // A normal user-defined method.
   METHOD_BLOCK,
+
+  // A user-defined method whose body only returns one of the receiver's
+  // fields, like `x { _x }`. It is run without a call frame.
+  METHOD_FIELD_GETTER,
+
+  // A user-defined method whose body only stores its first argument in one of
+  // the receiver's fields, like `x=(value) { _x = value }`. It is run without
+  // a call frame.
+  METHOD_FIELD_SETTER,
   
   // No method for the given symbol.
   METHOD_NONE
 } MethodType;
 
-typedef struct
+struct sMethod
 {
   MethodType type;
 
@@ -384,10 +513,34 @@ typedef struct
     Primitive primitive;
     WrenForeignMethodFn foreign;
     ObjClosure* closure;
+
+    // The receiver's field that a field getter or setter accesses.
+    int field;
   } as;
-} Method;
+};
 
-DECLARE_BUFFER(Method, Method);
+// The number of methods in each page of a class's method table, and its log2.
+#define METHOD_PAGE_BITS 4
+#define METHOD_PAGE_SIZE (1 << METHOD_PAGE_BITS)
+
+// The methods of a class, indexed by method symbol.
+//
+// Symbols are global, so a class only supports a few of them and they can be
+// far apart. Instead of one flat array with a cell for every symbol up to the
+// highest one the class supports, the table is split into pages of
+// METHOD_PAGE_SIZE methods, and only the pages that contain at least one of
+// the class's methods are allocated. Finding a method is still just two
+// indexing operations.
+typedef struct
+{
+  // The pages, indexed by symbol / METHOD_PAGE_SIZE. Pages without any method
+  // are NULL.
+  Method** pages;
+  int pageCount;
+
+  // The number of pages that are allocated.
+  int usedPages;
+} MethodTable;
 
 struct sObjClass
 {
@@ -401,12 +554,8 @@ struct sObjClass
   // The table of methods that are defined in or inherited by this class.
   // Methods are called by symbol, and the symbol directly maps to an index in
   // this table. This makes method calls fast at the expense of empty cells in
-  // the list for methods the class doesn't support.
-  //
-  // You can think of it as a hash table that never has collisions but has a
-  // really low load factor. Since methods are pretty small (just a type and a
-  // pointer), this should be a worthwhile trade-off.
-  MethodBuffer methods;
+  // the pages for methods the class doesn't support.
+  MethodTable methods;
 
   // The name of the class.
   ObjString* name;
@@ -463,6 +612,12 @@ typedef struct
 // for a key, we will continue past tombstones, because the desired key may be
 // found after them if the key that was removed was part of a prior collision.
 // When the array gets resized, all tombstones are discarded.
+//
+// A WeakMap is an ObjMap whose class is the WeakMap class. Its keys are
+// objects compared by identity and it holds them weakly: when the garbage
+// collector finds a key that is not reachable from anywhere else, its entry is
+// replaced with a tombstone. The value of an entry is only kept alive by the
+// map while its key is.
 typedef struct
 {
   Obj obj;
@@ -491,6 +646,16 @@ typedef struct
   bool isInclusive;
 } ObjRange;
 
+// A reference to an object that doesn't keep it alive. Once the garbage
+// collector finds [target] unreachable, it frees it and clears [target].
+typedef struct
+{
+  Obj obj;
+
+  // The referenced object, or NULL if it has been collected.
+  Obj* target;
+} ObjWeakRef;
+
 // An IEEE 754 double-precision float is a 64-bit value with bits laid out like:
 //
 // 1 Sign bit
@@ -633,6 +798,19 @@ ObjClass* wrenNewClass(WrenVM* vm, ObjClass* superclass, int numFields,
 
 void wrenBindMethod(WrenVM* vm, ObjClass* classObj, int symbol, Method method);
 
+// Returns the method [classObj] has for [symbol], or NULL if it has none.
+static inline Method* wrenFindMethod(ObjClass* classObj, int symbol)
+{
+  int page = symbol >> METHOD_PAGE_BITS;
+  if (page >= classObj->methods.pageCount) return NULL;
+
+  Method* methods = classObj->methods.pages[page];
+  if (methods == NULL) return NULL;
+
+  Method* method = &methods[symbol & (METHOD_PAGE_SIZE - 1)];
+  return method->type == METHOD_NONE ? NULL : method;
+}
+
 // Creates a new closure object that invokes [fn]. Allocates room for its
 // upvalues, but assumes outside code will populate it.
 ObjClosure* wrenNewClosure(WrenVM* vm, ObjFn* fn);
@@ -670,6 +848,9 @@ ObjFn* wrenNewFunction(WrenVM* vm, ObjModule* module, int maxSlots);
 
 void wrenFunctionBindName(WrenVM* vm, ObjFn* fn, const char* name, int length);
 
+// Allocates [count] empty inline caches for the calls in [fn]'s bytecode.
+void wrenFunctionInitCallCaches(WrenVM* vm, ObjFn* fn, int count);
+
 // Creates a new instance of the given [classObj].
 Value wrenNewInstance(WrenVM* vm, ObjClass* classObj);
 
@@ -689,6 +870,12 @@ int wrenListIndexOf(WrenVM* vm, ObjList* list, Value value);
 // Creates a new empty map.
 ObjMap* wrenNewMap(WrenVM* vm);
 
+// Creates a new empty map that holds its keys weakly.
+ObjMap* wrenNewWeakMap(WrenVM* vm);
+
+// Returns true if [map] holds its keys weakly.
+bool wrenIsWeakMap(WrenVM* vm, ObjMap* map);
+
 // Validates that [arg] is a valid object for use as a map key. Returns true if
 // it is and returns false otherwise. Use validateKey usually, for a runtime error.
 // This separation exists to aid the API in surfacing errors to the developer as well.
@@ -713,6 +900,21 @@ ObjModule* wrenNewModule(WrenVM* vm, ObjString* name);
 // Creates a new range from [from] to [to].
 Value wrenNewRange(WrenVM* vm, double from, double to, bool isInclusive);
 
+// Creates a new, empty string builder.
+ObjStringBuilder* wrenNewStringBuilder(WrenVM* vm);
+
+// Inserts the [length] bytes at [bytes] into [builder] before byte [index],
+// growing it if needed. [bytes] must not point into [builder] itself.
+void wrenStringBuilderInsert(WrenVM* vm, ObjStringBuilder* builder,
+                             uint32_t index, const char* bytes,
+                             uint32_t length);
+
+// Creates a new string containing the bytes in [builder].
+Value wrenStringBuilderToString(WrenVM* vm, ObjStringBuilder* builder);
+
+// Creates a new weak reference to [target].
+ObjWeakRef* wrenNewWeakRef(WrenVM* vm, Obj* target);
+
 // Creates a new string object and copies [text] into it.
 //
 // [text] must be non-NULL.
@@ -743,6 +945,13 @@ Value wrenNumToString(WrenVM* vm, double value);
 // @ - A Wren string object.
 Value wrenStringFormat(WrenVM* vm, const char* format, ...);
 
+// Creates a new string from the [count] strings in [strings] joined together,
+// with [separator] between them unless it's NULL, using a single allocation.
+// Since this allocates, [strings] must be reachable by the GC, such as on a
+// fiber's stack.
+Value wrenStringJoin(WrenVM* vm, const Value* strings, uint32_t count,
+                     ObjString* separator);
+
 // Creates a new string containing the UTF-8 encoding of [value].
 Value wrenStringFromCodePoint(WrenVM* vm, int value);
 
@@ -760,6 +969,12 @@ Value wrenStringCodePointAt(WrenVM* vm, ObjString* string, uint32_t index);
 uint32_t wrenStringFind(ObjString* haystack, ObjString* needle,
                         uint32_t startIndex);
 
+// Creates a new string from [string] with every occurrence of [from], which
+// must not be empty, replaced by [to]. The result is allocated once. Returns
+// [string] itself if [from] doesn't occur in it.
+Value wrenStringReplace(WrenVM* vm, ObjString* string, ObjString* from,
+                        ObjString* to);
+
 // Returns true if [a] and [b] represent the same string.
 static inline bool wrenStringEqualsCString(const ObjString* a,
                                            const char* b, size_t length)
@@ -782,12 +997,34 @@ void wrenGrayValue(WrenVM* vm, Value value);
 // be called during the sweep phase of a garbage collection.
 void wrenGrayBuffer(WrenVM* vm, ValueBuffer* buffer);
 
+// Puts [obj], which has already been traced, back on the gray stack so that it
+// is traced again.
+void wrenRegrayObj(WrenVM* vm, Obj* obj);
+
 // Processes every object in the gray stack until all reachable objects have
 // been marked. After that, all objects are either white (freeable) or black
 // (in use and fully traversed).
 void wrenBlackenObjects(WrenVM* vm);
 
+// Processes at most [limit] objects from the gray stack and returns how many
+// were processed. Fibers are changed without write barriers, so the ones
+// traced here are also remembered to be traced again when marking finishes.
+int wrenBlackenSomeObjects(WrenVM* vm, int limit);
+
+// Once every reachable object has been marked, marks the values of the weak
+// map entries whose keys were reached, then clears the weak references and
+// removes the weak map entries whose targets and keys were not.
+void wrenClearWeakReferences(WrenVM* vm);
+
+// Returns the number of bytes of memory owned by [obj], including [obj] itself.
+// This is what the garbage collector counts as still in use when [obj] is
+// reached.
+size_t wrenObjectSize(Obj* obj);
+
 // Releases all memory owned by [obj], including [obj] itself.
+//
+// Foreign objects must have been finalized first. This may be called from the
+// sweeper thread, so it doesn't touch anything but [obj].
 void wrenFreeObj(WrenVM* vm, Obj* obj);
 
 // Returns the class of [value].
@@ -833,7 +1070,7 @@ static inline bool wrenIsBool(Value value)
 // directly, instead use the [IS___] macro for the type in question.
 static inline bool wrenIsObjType(Value value, ObjType type)
 {
-  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+  return IS_OBJ(value) && wrenObjType(AS_OBJ(value)) == type;
 }
 
 // Converts the raw object pointer [obj] to a [Value].
@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <math.h>
 #include <string.h>
 
 #include "wren.h"
@@ -15,9 +16,13 @@
 #if WREN_OPT_RANDOM
   #include "wren_opt_random.h"
 #endif
+#if WREN_OPT_PROFILER
+  #include "wren_opt_profiler.h"
+#endif
+
+#include <time.h>
 
 #if WREN_DEBUG_TRACE_MEMORY || WREN_DEBUG_TRACE_GC
-  #include <time.h>
   #include <stdio.h>
 #endif
 
@@ -53,6 +58,9 @@ void wrenInitConfiguration(WrenConfiguration* config)
   config->initialHeapSize = 1024 * 1024 * 10;
   config->minHeapSize = 1024 * 1024;
   config->heapGrowthPercent = 50;
+  config->gcStepSize = 0;
+  config->idleHeapGrowthPercent = 0;
+  config->useSlabAllocator = false;
   config->userData = NULL;
 }
 
@@ -89,8 +97,19 @@ WrenVM* wrenNewVM(WrenConfiguration* config)
   vm->gray = (Obj**)reallocate(NULL, vm->grayCapacity * sizeof(Obj*), userData);
   vm->nextGC = vm->config.initialHeapSize;
 
+  // Nothing has been collected yet, so an idle collection may as well happen
+  // as soon as the heap has grown a little.
+  vm->idleGC = vm->config.idleHeapGrowthPercent > 0
+      ? vm->config.minHeapSize : vm->nextGC;
+
   wrenSymbolTableInit(&vm->methodNames);
 
+  if (vm->config.useSlabAllocator) vm->slab = wrenNewSlab(vm);
+
+#if WREN_BACKGROUND_SWEEP
+  vm->sweeper = wrenNewSweeper(vm);
+#endif
+
   vm->modules = wrenNewMap(vm);
   wrenInitializeCore(vm);
   return vm;
@@ -99,18 +118,38 @@ WrenVM* wrenNewVM(WrenConfiguration* config)
 void wrenFreeVM(WrenVM* vm)
 {
   ASSERT(vm->methodNames.count > 0, "VM appears to have already been freed.");
+
+#if WREN_OPT_PROFILER
+  // Discard the samples if the profiler is still attached to this VM.
+  wrenProfilerStop(vm, NULL);
+#endif
   
-  // Free all of the GC objects.
-  Obj* obj = vm->first;
-  while (obj != NULL)
+#if WREN_BACKGROUND_SWEEP
+  // Let the sweeper finish freeing the unreachable objects it has been given.
+  if (vm->sweeper != NULL) wrenFreeSweeper(vm->sweeper);
+#endif
+
+  // Free all of the GC objects, including those in the middle of a sweep.
+  Obj* lists[] = { vm->first, vm->swept, vm->unswept };
+  for (int i = 0; i < 3; i++)
   {
-    Obj* next = obj->next;
-    wrenFreeObj(vm, obj);
-    obj = next;
+    Obj* obj = lists[i];
+    while (obj != NULL)
+    {
+      Obj* next = wrenObjNext(obj);
+      if (wrenObjType(obj) == OBJ_FOREIGN)
+      {
+        wrenFinalizeForeign(vm, (ObjForeign*)obj);
+      }
+      wrenFreeObj(vm, obj);
+      obj = next;
+    }
   }
 
   // Free up the GC gray set.
   vm->gray = (Obj**)vm->config.reallocateFn(vm->gray, 0, vm->config.userData);
+  vm->config.reallocateFn(vm->grayAgain, 0, vm->config.userData);
+  vm->config.reallocateFn(vm->weak, 0, vm->config.userData);
 
   // Tell the user if they didn't free any handles. We don't want to just free
   // them here because the host app may still have pointers to them that they
@@ -119,30 +158,24 @@ void wrenFreeVM(WrenVM* vm)
 
   wrenSymbolTableClear(vm, &vm->methodNames);
 
-  DEALLOCATE(vm, vm);
-}
-
-void wrenCollectGarbage(WrenVM* vm)
-{
-#if WREN_DEBUG_TRACE_MEMORY || WREN_DEBUG_TRACE_GC
-  printf("-- gc --\n");
+#if WREN_DEBUG_COUNT_EXECUTION
+  vm->config.reallocateFn(vm->callCounts, 0, vm->config.userData);
+#endif
 
-  size_t before = vm->bytesAllocated;
-  double startTime = (double)clock() / CLOCKS_PER_SEC;
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  wrenFreeAllocations(vm);
 #endif
 
-  // Mark all reachable objects.
+  // The VM itself came straight from the host.
+  if (vm->slab != NULL) wrenFreeSlab(vm->slab);
+  vm->slab = NULL;
 
-  // Reset this. As we mark objects, their size will be counted again so that
-  // we can track how much memory is in use without needing to know the size
-  // of each *freed* object.
-  //
-  // This is important because when freeing an unmarked object, we don't always
-  // know how much memory it is using. For example, when freeing an instance,
-  // we need to know its class to know how big it is, but its class may have
-  // already been freed.
-  vm->bytesAllocated = 0;
+  DEALLOCATE(vm, vm);
+}
 
+// Grays the objects the rest of the heap is reached from.
+static void grayRoots(WrenVM* vm)
+{
   wrenGrayObj(vm, (Obj*)vm->modules);
 
   // Temporary roots.
@@ -167,49 +200,255 @@ void wrenCollectGarbage(WrenVM* vm)
 
   // Method names.
   wrenBlackenSymbolTable(vm, &vm->methodNames);
+}
+
+static void startCollection(WrenVM* vm)
+{
+  // As we mark objects, their size will be counted so that we can track how
+  // much memory is in use without needing to know the size of each *freed*
+  // object.
+  //
+  // This is important because when freeing an unmarked object, we don't always
+  // know how much memory it is using. For example, when freeing an instance,
+  // we need to know its class to know how big it is, but its class may have
+  // already been freed.
+  vm->bytesMarked = 0;
+  vm->gcPhase = GC_MARK;
+
+  // Let the pages the sweeper emptied out last time be reused, even by size
+  // classes that haven't run out of blocks since.
+  if (vm->slab != NULL) wrenSlabReclaim(vm->slab);
+
+  grayRoots(vm);
+}
+
+// Marks everything that is still unmarked in one go and gets ready to sweep.
+static void finishMarking(WrenVM* vm)
+{
+  // The roots may have changed since the collection started, and the fibers
+  // traced so far may have been too.
+  grayRoots(vm);
+  for (int i = 0; i < vm->grayAgainCount; i++)
+  {
+    wrenRegrayObj(vm, vm->grayAgain[i]);
+  }
+  vm->grayAgainCount = 0;
 
   // Now that we have grayed the roots, do a depth-first search over all of the
   // reachable objects.
   wrenBlackenObjects(vm);
+  wrenClearWeakReferences(vm);
+
+  vm->gcStats.heapBefore = vm->bytesAllocated;
+  vm->bytesAllocated = vm->bytesMarked;
+  vm->gcStats.heapAfter = vm->bytesAllocated;
+
+  // Calculate the next gc point, this is the current allocation plus
+  // a configured percentage of the current allocation.
+  vm->nextGC = vm->bytesAllocated + ((vm->bytesAllocated * vm->config.heapGrowthPercent) / 100);
+  if (vm->nextGC < vm->config.minHeapSize) vm->nextGC = vm->config.minHeapSize;
+
+  vm->idleGC = vm->nextGC;
+  if (vm->config.idleHeapGrowthPercent > 0)
+  {
+    vm->idleGC = vm->bytesAllocated + ((vm->bytesAllocated * vm->config.idleHeapGrowthPercent) / 100);
+  }
+
+  // Objects allocated from now on are white and go in a new list, so the
+  // marked ones don't get mixed up with them.
+  vm->unswept = vm->first;
+  vm->first = NULL;
+  vm->gcPhase = GC_SWEEP;
+}
 
-  // Collect the white objects.
-  Obj** obj = &vm->first;
-  while (*obj != NULL)
+// Sweeps at most [limit] objects, or all of them if [limit] is -1.
+static void sweep(WrenVM* vm, int limit)
+{
+#if WREN_BACKGROUND_SWEEP
+  // The unreached objects to hand over to the sweeper.
+  Obj* unreached = NULL;
+  Obj* lastUnreached = NULL;
+#endif
+
+  while (vm->unswept != NULL && limit-- != 0)
   {
-    if (!((*obj)->isDark))
+    Obj* obj = vm->unswept;
+    vm->unswept = wrenObjNext(obj);
+
+    if (!wrenIsDark(obj))
+    {
+      // This object wasn't reached, so free it. Foreign objects are finalized
+      // here, on the VM's thread, even when the sweeper frees them.
+      if (wrenObjType(obj) == OBJ_FOREIGN)
+      {
+        wrenFinalizeForeign(vm, (ObjForeign*)obj);
+      }
+
+#if WREN_BACKGROUND_SWEEP
+      if (vm->sweeper != NULL)
+      {
+        wrenSetObjNext(obj, unreached);
+        if (unreached == NULL) lastUnreached = obj;
+        unreached = obj;
+        continue;
+      }
+#endif
+
+      wrenFreeObj(vm, obj);
+      continue;
+    }
+
+    // This object was reached, so keep it in the same order. Foreign objects
+    // are newer than their class, and their finalizer needs the class when
+    // both are freed in the same sweep.
+    //
+    // Survivors aren't written to unless they have to be, so that sweeping
+    // doesn't dirty the memory of a mostly live heap. Objects in the slab
+    // allocator's pages are unmarked all at once when the sweep is done, and
+    // the survivors are only relinked where something between them was freed.
+    if ((obj->header & OBJ_IN_PAGE) == 0) wrenSetDark(obj, false);
+    if (vm->lastSwept == NULL)
     {
-      // This object wasn't reached, so remove it from the list and free it.
-      Obj* unreached = *obj;
-      *obj = unreached->next;
-      wrenFreeObj(vm, unreached);
+      vm->swept = obj;
     }
-    else
+    else if (wrenObjNext(vm->lastSwept) != obj)
     {
-      // This object was reached, so unmark it (for the next GC) and move on to
-      // the next.
-      (*obj)->isDark = false;
-      obj = &(*obj)->next;
+      wrenSetObjNext(vm->lastSwept, obj);
     }
+    vm->lastSwept = obj;
   }
 
-  // Calculate the next gc point, this is the current allocation plus
-  // a configured percentage of the current allocation.
-  vm->nextGC = vm->bytesAllocated + ((vm->bytesAllocated * vm->config.heapGrowthPercent) / 100);
-  if (vm->nextGC < vm->config.minHeapSize) vm->nextGC = vm->config.minHeapSize;
+  // The last survivor may still point at the objects that haven't been swept.
+  if (vm->lastSwept != NULL && wrenObjNext(vm->lastSwept) != NULL)
+  {
+    wrenSetObjNext(vm->lastSwept, NULL);
+  }
+
+#if WREN_BACKGROUND_SWEEP
+  if (unreached != NULL) wrenSweeperFree(vm->sweeper, unreached, lastUnreached);
+#endif
+
+  if (vm->unswept != NULL) return;
+
+  // Put the survivors back after the objects allocated while sweeping.
+  if (vm->first == NULL)
+  {
+    vm->first = vm->swept;
+  }
+  else
+  {
+    Obj* last = vm->first;
+    while (wrenObjNext(last) != NULL) last = wrenObjNext(last);
+    wrenSetObjNext(last, vm->swept);
+  }
+
+  if (vm->slab != NULL) wrenSlabClearMarks(vm->slab);
+
+  vm->swept = NULL;
+  vm->lastSwept = NULL;
+  vm->gcPhase = GC_IDLE;
+  vm->gcStats.collections++;
+}
+
+static void recordPause(WrenVM* vm, double startTime)
+{
+  double elapsed = wrenWallClock() - startTime;
+  GCStats* stats = &vm->gcStats;
+  stats->totalPause += elapsed;
+  stats->lastPause = elapsed;
+  if (elapsed > stats->maxPause) stats->maxPause = elapsed;
+}
+
+void wrenCollectGarbage(WrenVM* vm)
+{
+#if WREN_DEBUG_TRACE_MEMORY || WREN_DEBUG_TRACE_GC
+  printf("-- gc --\n");
+#endif
+
+  double startTime = wrenWallClock();
+
+  // Finish the incremental collection in progress, if there is one. Objects
+  // that it already found to be reachable survive this time, even if they
+  // aren't anymore.
+  if (vm->gcPhase == GC_SWEEP) sweep(vm, -1);
+  if (vm->gcPhase == GC_IDLE) startCollection(vm);
+  finishMarking(vm);
+  sweep(vm, -1);
+
+  recordPause(vm, startTime);
 
 #if WREN_DEBUG_TRACE_MEMORY || WREN_DEBUG_TRACE_GC
-  double elapsed = ((double)clock() / CLOCKS_PER_SEC) - startTime;
   // Explicit cast because size_t has different sizes on 32-bit and 64-bit and
   // we need a consistent type for the format string.
   printf("GC %lu before, %lu after (%lu collected), next at %lu. Took %.3fms.\n",
-         (unsigned long)before,
+         (unsigned long)vm->gcStats.heapBefore,
          (unsigned long)vm->bytesAllocated,
-         (unsigned long)(before - vm->bytesAllocated),
+         (unsigned long)(vm->gcStats.heapBefore - vm->bytesAllocated),
          (unsigned long)vm->nextGC,
-         elapsed*1000.0);
+         vm->gcStats.lastPause*1000.0);
 #endif
 }
 
+// Marks or sweeps at most [limit] objects of the collection in progress.
+static void collectSome(WrenVM* vm, int limit)
+{
+  if (vm->gcPhase == GC_MARK)
+  {
+    wrenBlackenSomeObjects(vm, limit);
+    if (vm->grayCount == 0) finishMarking(vm);
+  }
+  else
+  {
+    sweep(vm, limit);
+  }
+}
+
+bool wrenCollectGarbageStep(WrenVM* vm)
+{
+  if (vm->config.gcStepSize == 0) return false;
+
+  if (vm->gcPhase == GC_IDLE)
+  {
+    if (vm->bytesAllocated <= vm->nextGC) return false;
+    startCollection(vm);
+  }
+
+  double startTime = wrenWallClock();
+  collectSome(vm, vm->config.gcStepSize);
+  recordPause(vm, startTime);
+
+  return vm->gcPhase != GC_IDLE;
+}
+
+bool wrenCollectGarbageFor(WrenVM* vm, double seconds)
+{
+  if (vm->gcPhase == GC_IDLE)
+  {
+    if (vm->bytesAllocated <= vm->idleGC) return false;
+    startCollection(vm);
+  }
+
+  // Check the time every few hundred objects, which takes a few microseconds.
+  // The budget is wall clock time, since that is what the host has to spare.
+  double startTime = wrenWallClock();
+  do
+  {
+    collectSome(vm, 256);
+  }
+  while (vm->gcPhase != GC_IDLE && wrenWallClock() - startTime < seconds);
+  recordPause(vm, startTime);
+
+  return vm->gcPhase != GC_IDLE;
+}
+
+// Passes a request on to the slab allocator, if the VM uses one, or else to
+// the host's allocator.
+static void* allocate(WrenVM* vm, void* memory, size_t newSize)
+{
+  if (vm->slab != NULL) return wrenSlabReallocate(vm->slab, memory, newSize);
+  return vm->config.reallocateFn(memory, newSize, vm->config.userData);
+}
+
 void* wrenReallocate(WrenVM* vm, void* memory, size_t oldSize, size_t newSize)
 {
 #if WREN_DEBUG_TRACE_MEMORY
@@ -219,10 +458,16 @@ void* wrenReallocate(WrenVM* vm, void* memory, size_t oldSize, size_t newSize)
          memory, (unsigned long)oldSize, (unsigned long)newSize);
 #endif
 
-  // If new bytes are being allocated, add them to the total count. If objects
-  // are being completely deallocated, we don't track that (since we don't
-  // track the original size). Instead, that will be handled while marking
-  // during the next GC.
+  // If objects are being completely deallocated, we don't track that (since we
+  // don't track the original size). Instead, that will be handled while marking
+  // during the next GC. This doesn't touch the VM at all, so that the sweeper
+  // thread can free objects through here too.
+  if (oldSize == 0 && newSize == 0)
+  {
+    return allocate(vm, memory, 0);
+  }
+
+  // If new bytes are being allocated, add them to the total count.
   vm->bytesAllocated += newSize - oldSize;
 
 #if WREN_DEBUG_GC_STRESS
@@ -230,10 +475,29 @@ void* wrenReallocate(WrenVM* vm, void* memory, size_t oldSize, size_t newSize)
   // recurse.
   if (newSize > 0) wrenCollectGarbage(vm);
 #else
-  if (newSize > 0 && vm->bytesAllocated > vm->nextGC) wrenCollectGarbage(vm);
+  if (newSize > 0 && vm->bytesAllocated > vm->nextGC)
+  {
+    // An incremental collection is only started here and the host does the
+    // rest of the work, unless it has fallen too far behind.
+    if (vm->config.gcStepSize == 0 || vm->bytesAllocated / 2 > vm->nextGC)
+    {
+      wrenCollectGarbage(vm);
+    }
+    else if (vm->gcPhase == GC_IDLE)
+    {
+      startCollection(vm);
+    }
+  }
 #endif
 
-  return vm->config.reallocateFn(memory, newSize, vm->config.userData);
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  // Everything is counted as a buffer until an object is initialized in it.
+  // This happens after collecting, since the GC frees through here too.
+  vm->lastAllocationSize = memory == NULL ? newSize : 0;
+  if (newSize > oldSize) wrenTrackAllocation(vm, NULL, newSize - oldSize);
+#endif
+
+  return allocate(vm, memory, newSize);
 }
 
 // Captures the local variable [local] into an [Upvalue]. If that local is
@@ -284,7 +548,7 @@ static ObjUpvalue* captureUpvalue(WrenVM* vm, ObjFiber* fiber, Value* local)
 
 // Closes any open upvalues that have been created for stack slots at [last]
 // and above.
-static void closeUpvalues(ObjFiber* fiber, Value* last)
+static void closeUpvalues(WrenVM* vm, ObjFiber* fiber, Value* last)
 {
   while (fiber->openUpvalues != NULL &&
          fiber->openUpvalues->value >= last)
@@ -292,6 +556,7 @@ static void closeUpvalues(ObjFiber* fiber, Value* last)
     ObjUpvalue* upvalue = fiber->openUpvalues;
 
     // Move the value into the upvalue itself and point the upvalue to it.
+    wrenWriteBarrier(vm, (Obj*)upvalue);
     upvalue->closed = *upvalue->value;
     upvalue->value = &upvalue->closed;
 
@@ -332,6 +597,12 @@ static WrenForeignMethodFn findForeignMethod(WrenVM* vm,
     {
       method = wrenRandomBindForeignMethod(vm, className, isStatic, signature);
     }
+#endif
+#if WREN_OPT_PROFILER
+    if (strcmp(moduleName, "profiler") == 0)
+    {
+      method = wrenProfilerBindForeignMethod(vm, className, isStatic, signature);
+    }
 #endif
   }
 
@@ -371,11 +642,23 @@ static void bindMethod(WrenVM* vm, int methodType, int symbol,
   }
   else
   {
-    method.as.closure = AS_CLOSURE(methodValue);
-    method.type = METHOD_BLOCK;
+    ObjClosure* closure = AS_CLOSURE(methodValue);
 
     // Patch up the bytecode now that we know the superclass.
-    wrenBindMethodCode(classObj, method.as.closure->fn);
+    wrenBindMethodCode(classObj, closure->fn);
+
+    // Trivial getters and setters access the field directly instead of
+    // running their code.
+    int field;
+    method.type = wrenMethodBodyType(closure->fn, &field);
+    if (method.type == METHOD_BLOCK)
+    {
+      method.as.closure = closure;
+    }
+    else
+    {
+      method.as.field = field;
+    }
   }
 
   wrenBindMethod(vm, classObj, symbol, method);
@@ -441,6 +724,37 @@ static void methodNotFound(WrenVM* vm, ObjClass* classObj, int symbol)
       OBJ_VAL(classObj->name), vm->methodNames.data[symbol]->value);
 }
 
+// Returns the iterator after [iterator] in the range from [from] to [to], or
+// false if there are no more. Behaves exactly like Range.iterate(), so that for
+// loops over range literals count the same way as over ranges.
+static Value rangeIterate(double from, double to, bool isInclusive,
+                          Value iterator)
+{
+  // Special case: empty range.
+  if (from == to && !isInclusive) return FALSE_VAL;
+
+  // Start the iteration.
+  if (IS_NULL(iterator)) return NUM_VAL(from);
+
+  double next = AS_NUM(iterator);
+
+  // Iterate towards [to] from [from].
+  if (from < to)
+  {
+    next++;
+    if (next > to) return FALSE_VAL;
+  }
+  else
+  {
+    next--;
+    if (next < to) return FALSE_VAL;
+  }
+
+  if (!isInclusive && next == to) return FALSE_VAL;
+
+  return NUM_VAL(next);
+}
+
 // Looks up the previously loaded module with [name].
 //
 // Returns `NULL` if no module with that name has been loaded.
@@ -526,6 +840,7 @@ static Value validateSuperclass(WrenVM* vm, Value name, Value superclassValue,
       superclass == vm->mapClass ||
       superclass == vm->rangeClass ||
       superclass == vm->stringClass ||
+      superclass == vm->stringBuilderClass ||
       superclass == vm->boolClass ||
       superclass == vm->nullClass ||
       superclass == vm->numClass)
@@ -625,7 +940,8 @@ static void endClass(WrenVM* vm)
   vm->fiber->stackTop -= 2;
 
   ObjClass* classObj = AS_CLASS(classValue);
-    classObj->attributes = attributes;
+  wrenWriteBarrier(vm, (Obj*)classObj);
+  classObj->attributes = attributes;
 }
 
 // Creates a new class.
@@ -664,8 +980,8 @@ static void createForeign(WrenVM* vm, ObjFiber* fiber, Value* stack)
   int symbol = wrenSymbolTableFind(&vm->methodNames, "<allocate>", 10);
   ASSERT(symbol != -1, "Should have defined <allocate> symbol.");
 
-  ASSERT(classObj->methods.count > symbol, "Class should have allocator.");
-  Method* method = &classObj->methods.data[symbol];
+  Method* method = wrenFindMethod(classObj, symbol);
+  ASSERT(method != NULL, "Class should have allocator.");
   ASSERT(method->type == METHOD_FOREIGN, "Allocator should be foreign.");
 
   // Pass the constructor arguments to the allocator as well.
@@ -688,10 +1004,8 @@ void wrenFinalizeForeign(WrenVM* vm, ObjForeign* foreign)
 
   // If the class doesn't have a finalizer, bail out.
   ObjClass* classObj = foreign->obj.classObj;
-  if (symbol >= classObj->methods.count) return;
-
-  Method* method = &classObj->methods.data[symbol];
-  if (method->type == METHOD_NONE) return;
+  Method* method = wrenFindMethod(classObj, symbol);
+  if (method == NULL) return;
 
   ASSERT(method->type == METHOD_FOREIGN, "Finalizer should be foreign.");
 
@@ -757,6 +1071,9 @@ static Value importModule(WrenVM* vm, Value name)
 #endif
 #if WREN_OPT_RANDOM
     if (strcmp(nameString->value, "random") == 0) result.source = wrenRandomSource();
+#endif
+#if WREN_OPT_PROFILER
+    if (strcmp(nameString->value, "profiler") == 0) result.source = wrenProfilerSource();
 #endif
   }
   
@@ -821,6 +1138,28 @@ inline static bool checkArity(WrenVM* vm, Value value, int numArgs)
 }
 
 
+#if WREN_DEBUG_COUNT_EXECUTION
+// Counts a call made through method [symbol], growing the count array if the
+// symbol table has grown since the last call.
+static void countCall(WrenVM* vm, int symbol)
+{
+  if (symbol >= vm->callCountsCapacity)
+  {
+    int capacity = wrenPowerOf2Ceil(vm->methodNames.count);
+    if (capacity <= symbol) capacity = wrenPowerOf2Ceil(symbol + 1);
+
+    // Not counted as GC memory, so a call can't trigger a collection.
+    vm->callCounts = (uint64_t*)vm->config.reallocateFn(vm->callCounts,
+        sizeof(uint64_t) * capacity, vm->config.userData);
+    memset(vm->callCounts + vm->callCountsCapacity, 0,
+           sizeof(uint64_t) * (capacity - vm->callCountsCapacity));
+    vm->callCountsCapacity = capacity;
+  }
+
+  vm->callCounts[symbol]++;
+}
+#endif
+
 // The main bytecode interpreter loop. This is where the magic happens. It is
 // also, as you can imagine, highly performance critical.
 static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
@@ -887,6 +1226,61 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
     #define DEBUG_TRACE_INSTRUCTIONS() do { } while (false)
   #endif
 
+  #if WREN_DEBUG_COUNT_EXECUTION
+    // Counts the instruction that is about to be executed.
+    #define COUNT_INSTRUCTION()                                                \
+        do                                                                     \
+        {                                                                      \
+          vm->opcodeCounts[*ip]++;                                             \
+          fn->executionCount++;                                                \
+        } while (false)
+
+    #define COUNT_CALL(symbol) countCall(vm, symbol)
+  #else
+    #define COUNT_INSTRUCTION() do { } while (false)
+    #define COUNT_CALL(symbol) do { } while (false)
+  #endif
+
+  #if WREN_DEBUG_TRACK_ALLOCATIONS
+    // Keeps the frame's IP current so allocations can be attributed to the
+    // line that made them.
+    #define TRACK_IP() STORE_FRAME()
+  #else
+    #define TRACK_IP() do { } while (false)
+  #endif
+
+  #if WREN_OPT_PROFILER
+    // Takes a sample if the profiler's timer has fired since the last check.
+    #define PROFILER_CHECK()                                                   \
+        do                                                                     \
+        {                                                                      \
+          if (wrenProfilerPending)                                             \
+          {                                                                    \
+            STORE_FRAME();                                                     \
+            wrenProfilerSample(vm);                                            \
+          }                                                                    \
+        } while (false)
+  #else
+    #define PROFILER_CHECK() do { } while (false)
+  #endif
+
+  // Computes an infix operator inline when both operands are numbers and Num
+  // still has its built-in operators, skipping the symbol and cache index that
+  // follow the instruction. Otherwise, calls the operator method like CALL_1.
+  #define NUM_OPERATOR(result)                                                 \
+      do                                                                       \
+      {                                                                        \
+        if (vm->numOperatorsBuiltin && IS_NUM(PEEK2()) && IS_NUM(PEEK()))      \
+        {                                                                      \
+          double a = AS_NUM(PEEK2());                                          \
+          double b = AS_NUM(POP());                                            \
+          fiber->stackTop[-1] = result;                                        \
+          ip += 4;                                                             \
+          DISPATCH();                                                          \
+        }                                                                      \
+        goto callOperator;                                                     \
+      } while (false)
+
   #if WREN_COMPUTED_GOTO
 
   static void* dispatchTable[] = {
@@ -902,7 +1296,10 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       do                                                                       \
       {                                                                        \
         DEBUG_TRACE_INSTRUCTIONS();                                            \
-        goto *dispatchTable[instruction = (Code)READ_BYTE()];                  \
+        COUNT_INSTRUCTION();                                                   \
+        instruction = (Code)READ_BYTE();                                       \
+        TRACK_IP();                                                            \
+        goto *dispatchTable[instruction];                                      \
       } while (false)
 
   #else
@@ -910,7 +1307,10 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
   #define INTERPRET_LOOP                                                       \
       loop:                                                                    \
         DEBUG_TRACE_INSTRUCTIONS();                                            \
-        switch (instruction = (Code)READ_BYTE())
+        COUNT_INSTRUCTION();                                                   \
+        instruction = (Code)READ_BYTE();                                       \
+        TRACK_IP();                                                            \
+        switch (instruction)
 
   #define CASE_CODE(name)  case CODE_##name
   #define DISPATCH()       goto loop
@@ -958,6 +1358,10 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       stackStart[READ_BYTE()] = PEEK();
       DISPATCH();
 
+    CASE_CODE(STORE_LOCAL_POP):
+      stackStart[READ_BYTE()] = POP();
+      DISPATCH();
+
     CASE_CODE(CONSTANT):
       PUSH(fn->constants.data[READ_SHORT()]);
       DISPATCH();
@@ -977,6 +1381,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       Value* args;
       ObjClass* classObj;
 
+      CallCache* cache;
       Method* method;
 
     CASE_CODE(CALL_0):
@@ -998,7 +1403,10 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
     CASE_CODE(CALL_16):
       // Add one for the implicit receiver argument.
       numArgs = instruction - CODE_CALL_0 + 1;
+
+    callMethod:
       symbol = READ_SHORT();
+      cache = &fn->callCaches[READ_SHORT()];
 
       // The receiver is the first argument.
       args = fiber->stackTop - numArgs;
@@ -1031,15 +1439,177 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
 
       // The superclass is stored in a constant.
       classObj = AS_CLASS(fn->constants.data[READ_SHORT()]);
+      cache = &fn->callCaches[READ_SHORT()];
       goto completeCall;
 
+    CASE_CODE(ADD):           NUM_OPERATOR(NUM_VAL(a + b));
+    CASE_CODE(SUBTRACT):      NUM_OPERATOR(NUM_VAL(a - b));
+    CASE_CODE(MULTIPLY):      NUM_OPERATOR(NUM_VAL(a * b));
+    CASE_CODE(DIVIDE):        NUM_OPERATOR(NUM_VAL(a / b));
+    CASE_CODE(MODULO):        NUM_OPERATOR(NUM_VAL(fmod(a, b)));
+    CASE_CODE(LESS):          NUM_OPERATOR(BOOL_VAL(a < b));
+    CASE_CODE(GREATER):       NUM_OPERATOR(BOOL_VAL(a > b));
+    CASE_CODE(LESS_EQUAL):    NUM_OPERATOR(BOOL_VAL(a <= b));
+    CASE_CODE(GREATER_EQUAL): NUM_OPERATOR(BOOL_VAL(a >= b));
+    CASE_CODE(EQUAL):         NUM_OPERATOR(BOOL_VAL(a == b));
+    CASE_CODE(NOT_EQUAL):     NUM_OPERATOR(BOOL_VAL(a != b));
+
+    CASE_CODE(FOR_RANGE):
+      if (vm->numOperatorsBuiltin && IS_NUM(PEEK2()) && IS_NUM(PEEK()))
+      {
+        // Keep the bounds and skip the symbol, the cache index and the NULL
+        // that follows.
+        ip += 5;
+        DISPATCH();
+      }
+      goto callOperator;
+
+    CASE_CODE(FOR_RANGE_ITERATE):
+    {
+      // The loop's hidden locals hold the bounds and the iterator.
+      Value* hidden = stackStart + READ_BYTE();
+      bool isInclusive = READ_BYTE() != 0;
+
+      if (IS_NUM(hidden[1]))
+      {
+        PUSH(rangeIterate(AS_NUM(hidden[0]), AS_NUM(hidden[1]), isInclusive,
+                          hidden[2]));
+
+        // Skip the symbol and cache index.
+        ip += 4;
+        DISPATCH();
+      }
+
+      // The upper bound is null, so the first hidden local holds a sequence.
+      PUSH(hidden[0]);
+      PUSH(hidden[2]);
+      goto callOperator;
+    }
+
+    CASE_CODE(FOR_RANGE_VALUE):
+    {
+      Value* hidden = stackStart + READ_BYTE();
+      if (IS_NUM(hidden[1]))
+      {
+        // The iterator of a range is its value.
+        PUSH(hidden[2]);
+        ip += 4;
+        DISPATCH();
+      }
+
+      PUSH(hidden[0]);
+      PUSH(hidden[2]);
+      goto callOperator;
+    }
+
+    CASE_CODE(TO_STRING):
+    {
+      Value value = PEEK();
+
+      // Strings can't be subclassed, so their "toString" returns themselves.
+      if (IS_STRING(value))
+      {
+        ip += 4;
+        DISPATCH();
+      }
+
+      if (IS_NUM(value) && vm->numOperatorsBuiltin)
+      {
+        fiber->stackTop[-1] = wrenNumToString(vm, AS_NUM(value));
+        ip += 4;
+        DISPATCH();
+      }
+
+      numArgs = 1;
+      goto callMethod;
+    }
+
+    CASE_CODE(INTERPOLATE):
+    {
+      int count = READ_SHORT();
+      Value* parts = fiber->stackTop - count;
+      for (int i = 0; i < count; i++)
+      {
+        if (!IS_STRING(parts[i]))
+        {
+          vm->fiber->error = CONST_STRING(vm,
+              "Interpolated value's toString must return a string.");
+          RUNTIME_ERROR();
+        }
+      }
+
+      // A single part is already the result.
+      if (count > 1)
+      {
+        // The parts stay on the stack, and reachable, until the result is made.
+        Value result = wrenStringJoin(vm, parts, count, NULL);
+        fiber->stackTop -= count - 1;
+        fiber->stackTop[-1] = result;
+      }
+      DISPATCH();
+    }
+
+    CASE_CODE(CALL_FIELD_THIS_0):
+    {
+      uint8_t field = READ_BYTE();
+      Value receiver = stackStart[0];
+      ASSERT(IS_INSTANCE(receiver), "Receiver should be instance.");
+      ObjInstance* instance = AS_INSTANCE(receiver);
+      ASSERT(field < instance->obj.classObj->numFields, "Out of bounds field.");
+      PUSH(instance->fields[field]);
+      numArgs = 1;
+      goto callMethod;
+    }
+
+    CASE_CODE(CALL_LOCAL_CONSTANT):
+    {
+      Value receiver = stackStart[READ_BYTE()];
+      Value argument = fn->constants.data[READ_SHORT()];
+      Code call = (Code)READ_BYTE();
+
+      Value result;
+      if (vm->numOperatorsBuiltin && IS_NUM(receiver) && IS_NUM(argument) &&
+          wrenNumOperator(call, AS_NUM(receiver), AS_NUM(argument), &result))
+      {
+        PUSH(result);
+
+        // Skip the symbol and cache index.
+        ip += 4;
+        DISPATCH();
+      }
+
+      PUSH(receiver);
+      PUSH(argument);
+      goto callOperator;
+    }
+
+    callOperator:
+      // The receiver and its single argument are on top of the stack.
+      numArgs = 2;
+      goto callMethod;
+
     completeCall:
-      // If the class's method table doesn't include the symbol, bail.
-      if (symbol >= classObj->methods.count ||
-          (method = &classObj->methods.data[symbol])->type == METHOD_NONE)
+      PROFILER_CHECK();
+      COUNT_CALL(symbol);
+
+      if (cache->classObj == classObj)
       {
-        methodNotFound(vm, classObj, symbol);
-        RUNTIME_ERROR();
+        // Same class as last time, so it's the same method.
+        method = cache->method;
+      }
+      else
+      {
+        // If the class's method table doesn't include the symbol, bail.
+        method = wrenFindMethod(classObj, symbol);
+        if (method == NULL)
+        {
+          methodNotFound(vm, classObj, symbol);
+          RUNTIME_ERROR();
+        }
+
+        wrenWriteBarrier(vm, (Obj*)fn);
+        cache->classObj = classObj;
+        cache->method = method;
       }
 
       switch (method->type)
@@ -1084,6 +1654,28 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
           LOAD_FRAME();
           break;
 
+        case METHOD_FIELD_GETTER:
+        {
+          ASSERT(IS_INSTANCE(args[0]), "Receiver should be instance.");
+          ObjInstance* instance = AS_INSTANCE(args[0]);
+          args[0] = instance->fields[method->as.field];
+          fiber->stackTop -= numArgs - 1;
+          break;
+        }
+
+        case METHOD_FIELD_SETTER:
+        {
+          ASSERT(IS_INSTANCE(args[0]), "Receiver should be instance.");
+          ObjInstance* instance = AS_INSTANCE(args[0]);
+          wrenWriteBarrier(vm, (Obj*)instance);
+          instance->fields[method->as.field] = args[1];
+
+          // Like the setter's code, return the value that was stored.
+          args[0] = args[1];
+          fiber->stackTop -= numArgs - 1;
+          break;
+        }
+
         case METHOD_NONE:
           UNREACHABLE();
           break;
@@ -1100,8 +1692,9 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
 
     CASE_CODE(STORE_UPVALUE):
     {
-      ObjUpvalue** upvalues = frame->closure->upvalues;
-      *upvalues[READ_BYTE()]->value = PEEK();
+      ObjUpvalue* upvalue = frame->closure->upvalues[READ_BYTE()];
+      wrenWriteBarrier(vm, (Obj*)upvalue);
+      *upvalue->value = PEEK();
       DISPATCH();
     }
 
@@ -1110,9 +1703,15 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       DISPATCH();
 
     CASE_CODE(STORE_MODULE_VAR):
+      wrenWriteBarrier(vm, (Obj*)fn->module);
       fn->module->variables.data[READ_SHORT()] = PEEK();
       DISPATCH();
 
+    CASE_CODE(STORE_MODULE_VAR_POP):
+      wrenWriteBarrier(vm, (Obj*)fn->module);
+      fn->module->variables.data[READ_SHORT()] = POP();
+      DISPATCH();
+
     CASE_CODE(STORE_FIELD_THIS):
     {
       uint8_t field = READ_BYTE();
@@ -1120,10 +1719,23 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       ASSERT(IS_INSTANCE(receiver), "Receiver should be instance.");
       ObjInstance* instance = AS_INSTANCE(receiver);
       ASSERT(field < instance->obj.classObj->numFields, "Out of bounds field.");
+      wrenWriteBarrier(vm, (Obj*)instance);
       instance->fields[field] = PEEK();
       DISPATCH();
     }
 
+    CASE_CODE(STORE_FIELD_THIS_POP):
+    {
+      uint8_t field = READ_BYTE();
+      Value receiver = stackStart[0];
+      ASSERT(IS_INSTANCE(receiver), "Receiver should be instance.");
+      ObjInstance* instance = AS_INSTANCE(receiver);
+      ASSERT(field < instance->obj.classObj->numFields, "Out of bounds field.");
+      wrenWriteBarrier(vm, (Obj*)instance);
+      instance->fields[field] = POP();
+      DISPATCH();
+    }
+
     CASE_CODE(LOAD_FIELD):
     {
       uint8_t field = READ_BYTE();
@@ -1142,6 +1754,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       ASSERT(IS_INSTANCE(receiver), "Receiver should be instance.");
       ObjInstance* instance = AS_INSTANCE(receiver);
       ASSERT(field < instance->obj.classObj->numFields, "Out of bounds field.");
+      wrenWriteBarrier(vm, (Obj*)instance);
       instance->fields[field] = PEEK();
       DISPATCH();
     }
@@ -1158,6 +1771,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       // Jump back to the top of the loop.
       uint16_t offset = READ_SHORT();
       ip -= offset;
+      PROFILER_CHECK();
       DISPATCH();
     }
 
@@ -1208,7 +1822,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
 
     CASE_CODE(CLOSE_UPVALUE):
       // Close the upvalue for the local if we have one.
-      closeUpvalues(fiber, fiber->stackTop - 1);
+      closeUpvalues(vm, fiber, fiber->stackTop - 1);
       DROP();
       DISPATCH();
 
@@ -1218,7 +1832,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
       fiber->numFrames--;
 
       // Close any upvalues still in scope.
-      closeUpvalues(fiber, stackStart);
+      closeUpvalues(vm, fiber, stackStart);
 
       // If the fiber is complete, end it.
       if (fiber->numFrames == 0)
@@ -1387,6 +2001,7 @@ static WrenInterpretResult runInterpreter(WrenVM* vm, register ObjFiber* fiber)
 
   #undef READ_BYTE
   #undef READ_SHORT
+  #undef NUM_OPERATOR
 }
 
 WrenHandle* wrenMakeCallHandle(WrenVM* vm, const char* signature)
@@ -1431,10 +2046,13 @@ WrenHandle* wrenMakeCallHandle(WrenVM* vm, const char* signature)
   wrenByteBufferWrite(vm, &fn->code, (uint8_t)(CODE_CALL_0 + numParams));
   wrenByteBufferWrite(vm, &fn->code, (method >> 8) & 0xff);
   wrenByteBufferWrite(vm, &fn->code, method & 0xff);
+  wrenByteBufferWrite(vm, &fn->code, 0);
+  wrenByteBufferWrite(vm, &fn->code, 0);
   wrenByteBufferWrite(vm, &fn->code, CODE_RETURN);
   wrenByteBufferWrite(vm, &fn->code, CODE_END);
-  wrenIntBufferFill(vm, &fn->debug->sourceLines, 0, 5);
+  wrenIntBufferFill(vm, &fn->debug->sourceLines, 0, 7);
   wrenFunctionBindName(vm, fn, signature, signatureLength);
+  wrenFunctionInitCallCaches(vm, fn, 1);
 
   return value;
 }
@@ -1565,6 +2183,8 @@ int wrenDeclareVariable(WrenVM* vm, ObjModule* module, const char* name,
 {
   if (module->variables.count == MAX_MODULE_VARS) return -2;
 
+  wrenWriteBarrier(vm, (Obj*)module);
+
   // Implicitly defined variables get a "value" that is the line where the
   // variable is first used. We'll use that later to report an error on the
   // right line.
@@ -1577,6 +2197,7 @@ int wrenDefineVariable(WrenVM* vm, ObjModule* module, const char* name,
 {
   if (module->variables.count == MAX_MODULE_VARS) return -2;
 
+  wrenWriteBarrier(vm, (Obj*)module);
   if (IS_OBJ(value)) wrenPushRoot(vm, AS_OBJ(value));
 
   // See if the variable is already explicitly or implicitly declared.
@@ -1684,6 +2305,15 @@ bool wrenGetSlotBool(WrenVM* vm, int slot)
 const char* wrenGetSlotBytes(WrenVM* vm, int slot, int* length)
 {
   validateApiSlot(vm, slot);
+
+  // A string builder's bytes can be read in place, without making a string.
+  if (IS_STRING_BUILDER(vm->apiStack[slot]))
+  {
+    ByteBuffer* bytes = &AS_STRING_BUILDER(vm->apiStack[slot])->bytes;
+    *length = bytes->count;
+    return bytes->count == 0 ? "" : (const char*)bytes->data;
+  }
+
   ASSERT(IS_STRING(vm->apiStack[slot]), "Slot must hold a string.");
   
   ObjString* string = AS_STRING(vm->apiStack[slot]);
@@ -1711,6 +2341,13 @@ void* wrenGetSlotForeign(WrenVM* vm, int slot)
 const char* wrenGetSlotString(WrenVM* vm, int slot)
 {
   validateApiSlot(vm, slot);
+
+  if (IS_STRING_BUILDER(vm->apiStack[slot]))
+  {
+    int length;
+    return wrenGetSlotBytes(vm, slot, &length);
+  }
+
   ASSERT(IS_STRING(vm->apiStack[slot]), "Slot must hold a string.");
 
   return AS_CSTRING(vm->apiStack[slot]);
@@ -1823,6 +2460,7 @@ void wrenSetListElement(WrenVM* vm, int listSlot, int index, int elementSlot)
   uint32_t usedIndex = wrenValidateIndex(list->elements.count, index);
   ASSERT(usedIndex != UINT32_MAX, "Index out of bounds.");
   
+  wrenWriteBarrier(vm, (Obj*)list);
   list->elements.data[usedIndex] = vm->apiStack[elementSlot];
 }
 
@@ -1,10 +1,14 @@
 #ifndef wren_vm_h
 #define wren_vm_h
 
+#include <math.h>
+
 #include "wren_common.h"
 #include "wren_compiler.h"
 #include "wren_value.h"
 #include "wren_utils.h"
+#include "wren_slab.h"
+#include "wren_sweeper.h"
 
 // The maximum number of temporary objects that can be made visible to the GC
 // at one time.
@@ -17,6 +21,60 @@ typedef enum
   #undef OPCODE
 } Code;
 
+// The stages of a garbage collection. Between collections, every object is
+// white. While marking, the roots and then everything reachable from them are
+// traced, one gray object at a time, leaving them dark. Once marking is done,
+// the white objects are freed and the dark ones made white again.
+typedef enum
+{
+  GC_IDLE,
+  GC_MARK,
+  GC_SWEEP
+} GCPhase;
+
+// Running totals for the garbage collector, kept so they can be queried at
+// runtime. Times are wall clock seconds, measured with wrenWallClock().
+typedef struct
+{
+  // The number of collections so far.
+  uint64_t collections;
+
+  double totalPause;
+  double maxPause;
+  double lastPause;
+
+  // The value of [bytesAllocated] right before and after the last collection.
+  size_t heapBefore;
+  size_t heapAfter;
+} GCStats;
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+// The allocations of one kind of object made at one line of a function.
+typedef struct
+{
+  // The key. [fn] is NULL for allocations made outside of Wren code and [kind]
+  // is the class of instances and foreign objects or the ObjType otherwise.
+  ObjFn* fn;
+  int line;
+  const void* kind;
+
+  // Copied out when the site is first seen, since [fn] may be collected.
+  char site[96];
+  char kindName[40];
+
+  uint64_t count;
+  int64_t bytes;
+} AllocationSite;
+
+// Open addressing hash table of allocation sites.
+typedef struct
+{
+  AllocationSite* sites;
+  int capacity;
+  int count;
+} AllocationTable;
+#endif
+
 // A handle to a value, basically just a linked list of extra GC roots.
 //
 // Note that even non-heap-allocated values can be stored here.
@@ -36,11 +94,19 @@ struct WrenVM
   ObjClass* fnClass;
   ObjClass* listClass;
   ObjClass* mapClass;
+  ObjClass* weakMapClass;
+  ObjClass* weakRefClass;
   ObjClass* nullClass;
   ObjClass* numClass;
   ObjClass* objectClass;
   ObjClass* rangeClass;
   ObjClass* stringClass;
+  ObjClass* stringBuilderClass;
+
+  // True while Num's arithmetic and comparison operators are the built-in
+  // primitives, so that the interpreter may compute them inline when both
+  // operands are numbers. Binding any other method on Num clears it.
+  bool numOperatorsBuiltin;
 
   // The fiber that is currently running.
   ObjFiber* fiber;
@@ -67,6 +133,35 @@ struct WrenVM
   // The number of total allocated bytes that will trigger the next GC.
   size_t nextGC;
 
+  // The number of total allocated bytes past which a collection is started
+  // when the host has some idle time, see [wrenCollectGarbageFor()].
+  size_t idleGC;
+
+  // The stage of the collection in progress, if any.
+  GCPhase gcPhase;
+
+  // The number of bytes of the objects traced so far in the collection in
+  // progress.
+  size_t bytesMarked;
+
+  // The objects not swept yet while sweeping, and the ones that survived,
+  // in the same order.
+  Obj* unswept;
+  Obj* swept;
+  Obj* lastSwept;
+
+  // The allocator for the VM's small allocations, or NULL if it isn't used.
+  WrenSlab* slab;
+
+#if WREN_BACKGROUND_SWEEP
+  // The thread that frees unreachable objects, or NULL if it couldn't be
+  // started.
+  WrenSweeper* sweeper;
+#endif
+
+  // Statistics about the garbage collections so far.
+  GCStats gcStats;
+
   // The first object in the linked list of all currently allocated objects.
   Obj* first;
 
@@ -76,6 +171,18 @@ struct WrenVM
   int grayCount;
   int grayCapacity;
 
+  // The fibers traced so far in an incremental collection. They are modified
+  // without write barriers, so they are traced again when marking finishes.
+  Obj** grayAgain;
+  int grayAgainCount;
+  int grayAgainCapacity;
+
+  // The weak references and weak maps marked in the current collection. What
+  // they point to is only looked at once everything else has been marked.
+  Obj** weak;
+  int weakCount;
+  int weakCapacity;
+
   // The list of temporary roots. This is for temporary or new objects that are
   // not otherwise reachable but should not be collected.
   //
@@ -111,6 +218,26 @@ struct WrenVM
   // There is a single global symbol table for all method names on all classes.
   // Method calls are dispatched directly by index in this table.
   SymbolTable methodNames;
+
+#if WREN_DEBUG_COUNT_EXECUTION
+  // The number of times each instruction has been executed, indexed by opcode.
+  uint64_t opcodeCounts[CODE_END + 1];
+
+  // The number of calls made through each symbol in [methodNames].
+  uint64_t* callCounts;
+  int callCountsCapacity;
+#endif
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+  // Allocations since the VM was created and since the last frame was ended
+  // with wrenResetFrameAllocations().
+  AllocationTable allocations;
+  AllocationTable frameAllocations;
+
+  // The size of the most recent new allocation, which is attributed to the
+  // object initialized right after it.
+  size_t lastAllocationSize;
+#endif
 };
 
 // A generic allocation function that handles all explicit memory management.
@@ -131,6 +258,14 @@ struct WrenVM
 //   [oldSize] will be zero. It should return NULL.
 void* wrenReallocate(WrenVM* vm, void* memory, size_t oldSize, size_t newSize);
 
+// Does incremental garbage collection work for up to [seconds], for when the
+// host is idle. A new collection is started if the heap has grown past
+// [idleGC], which is usually reached well before [nextGC] so that collections
+// seldom have to be started by an allocation.
+//
+// Returns true if a collection is still in progress afterwards.
+bool wrenCollectGarbageFor(WrenVM* vm, double seconds);
+
 // Invoke the finalizer for the foreign object referenced by [foreign].
 void wrenFinalizeForeign(WrenVM* vm, ObjForeign* foreign);
 
@@ -236,6 +371,20 @@ static inline ObjClass* wrenGetClassInline(WrenVM* vm, Value value)
   return NULL;
 }
 
+// Tells the garbage collector that [obj] is about to be modified.
+//
+// An incremental collection doesn't look at an object again once it has been
+// traced, so if a reference to an untraced object were stored in it, that
+// object could be freed while still in use. Instead, a traced object is put
+// back on the gray stack when it changes.
+static inline void wrenWriteBarrier(WrenVM* vm, Obj* obj)
+{
+  if (vm->gcPhase == GC_MARK && wrenIsDark(obj) && !wrenIsGray(obj))
+  {
+    wrenRegrayObj(vm, obj);
+  }
+}
+
 // Returns `true` if [name] is a local variable name (starts with a lowercase
 // letter).
 static inline bool wrenIsLocalName(const char* name)
@@ -248,4 +397,27 @@ static inline bool wrenIsFalsyValue(Value value)
   return IS_FALSE(value) || IS_NULL(value);
 }
 
+// Computes infix operator [instruction] on numbers [a] and [b] the way Num's
+// built-in operator methods do and stores it in [result]. Returns `false` if
+// [instruction] isn't one of the operator instructions.
+static inline bool wrenNumOperator(Code instruction, double a, double b,
+                                   Value* result)
+{
+  switch (instruction)
+  {
+    case CODE_ADD:           *result = NUM_VAL(a + b); return true;
+    case CODE_SUBTRACT:      *result = NUM_VAL(a - b); return true;
+    case CODE_MULTIPLY:      *result = NUM_VAL(a * b); return true;
+    case CODE_DIVIDE:        *result = NUM_VAL(a / b); return true;
+    case CODE_MODULO:        *result = NUM_VAL(fmod(a, b)); return true;
+    case CODE_LESS:          *result = BOOL_VAL(a < b); return true;
+    case CODE_GREATER:       *result = BOOL_VAL(a > b); return true;
+    case CODE_LESS_EQUAL:    *result = BOOL_VAL(a <= b); return true;
+    case CODE_GREATER_EQUAL: *result = BOOL_VAL(a >= b); return true;
+    case CODE_EQUAL:         *result = BOOL_VAL(a == b); return true;
+    case CODE_NOT_EQUAL:     *result = BOOL_VAL(a != b); return true;
+    default:                 return false;
+  }
+}
+
 #endif
@@ -1,4 +1,6 @@
 #include "api/api.h"
+#include "lib/wren/wren_debug.h"
+#include "lib/wren/wren_opt_profiler.h"
 #include "renderer.h"
 #include <SDL2/SDL.h>
 #include <errno.h>
@@ -15,6 +17,21 @@
 SDL_Window *window;
 struct APIContext api_context;
 
+static WrenVM *main_vm;
+static const char *profile_path;
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+static FILE *alloc_report;
+static int alloc_frame;
+
+static void report_frame_allocations(WrenVM *vm)
+{
+    fprintf(alloc_report, "-- frame %d: ", ++alloc_frame);
+    wrenDumpAllocations(vm, alloc_report, true, 10);
+    wrenResetFrameAllocations(vm);
+}
+#endif
+
 static void init_window_icon(void)
 {
 #ifndef _WIN32
@@ -131,8 +148,92 @@ static WrenLoadModuleResult loadModuleFn(WrenVM *vm, const char *name)
     return res;
 }
 
+// writes the profile started through LITE_PROFILE, the execution counts of a
+// WREN_DEBUG_COUNT_EXECUTION build and the allocation report of a
+// WREN_DEBUG_TRACK_ALLOCATIONS build, called on exit
+static void write_profiles(void)
+{
+    if (!main_vm)
+        return;
+    if (profile_path && wrenProfilerIsRunning(main_vm) && !wrenProfilerStop(main_vm, profile_path))
+        fprintf(stderr, "Error: could not write profile to '%s'\n", profile_path);
+#if WREN_DEBUG_COUNT_EXECUTION
+    wrenDumpExecutionCounts(main_vm);
+#endif
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+    if (alloc_report)
+    {
+        fprintf(alloc_report, "-- total: ");
+        wrenDumpAllocations(main_vm, alloc_report, false, 50);
+        fclose(alloc_report);
+        alloc_report = NULL;
+    }
+#endif
+    main_vm = NULL;
+}
+
+static void init_config(WrenConfiguration *config)
+{
+    wrenInitConfiguration(config);
+    config->bindForeignMethodFn = apiBindForeignMethods;
+    config->bindForeignClassFn = apiBindForeignClasses;
+    config->writeFn = writeFn;
+    config->errorFn = errorFn;
+    config->loadModuleFn = loadModuleFn;
+    // collections are spread over frames, see f_end_frame, and mostly started
+    // in the idle part of a frame by System.gcStep before the heap gets large
+    config->gcStepSize = 5000;
+    config->heapGrowthPercent = 100;
+    config->idleHeapGrowthPercent = 20;
+    // the editor makes lots of small, short-lived objects (Vector.new, event
+    // lists), which are cheaper to allocate and free from size-class pages
+    config->useSlabAllocator = true;
+}
+
+static void usage_error(const char *message, const char *arg)
+{
+    fprintf(stderr, "%s: %s\n", message, arg);
+    exit(EXIT_FAILURE);
+}
+
+// returns the value following the option at argv[*i] and steps over it
+static const char *option_value(int argc, char **argv, int *i)
+{
+    if (*i + 1 >= argc)
+        usage_error("missing value for option", argv[*i]);
+    return argv[++*i];
+}
+
 int main(int argc, char **argv)
 {
+    // options handled here are stripped from the arguments passed to Wren
+    int headless_w = 0, headless_h = 0;
+    const char *dump_dir = NULL;
+    const char *record_file = NULL, *replay_file = NULL;
+    int nargs = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--headless"))
+        {
+            const char *size = option_value(argc, argv, &i);
+            if (sscanf(size, "%dx%d", &headless_w, &headless_h) != 2 || headless_w <= 0 || headless_h <= 0)
+                usage_error("invalid size for --headless, expected WxH", size);
+        }
+        else if (!strcmp(argv[i], "--dump-frames"))
+            dump_dir = option_value(argc, argv, &i);
+        else if (!strcmp(argv[i], "--record"))
+            record_file = option_value(argc, argv, &i);
+        else if (!strcmp(argv[i], "--replay"))
+            replay_file = option_value(argc, argv, &i);
+        else
+            argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    // headless runs go through the dummy video driver so no display is needed
+    if (headless_w)
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+
 #ifdef _WIN32
     HINSTANCE lib = LoadLibrary("user32.dll");
     int (*SetProcessDPIAware)() = (void *)GetProcAddress(lib, "SetProcessDPIAware");
@@ -151,23 +252,53 @@ int main(int argc, char **argv)
     SDL_SetHint(SDL_HINT_MOUSE_FOCUS_CLICKTHROUGH, "1");
 #endif
 
-    SDL_DisplayMode dm;
-    SDL_GetCurrentDisplayMode(0, &dm);
+    if (headless_w)
+    {
+        window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, headless_w, headless_h,
+                                  SDL_WINDOW_HIDDEN);
+        ren_init_headless(window, headless_w, headless_h);
+        ren_dump_frames(dump_dir);
+    }
+    else
+    {
+        SDL_DisplayMode dm;
+        SDL_GetCurrentDisplayMode(0, &dm);
+
+        window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, dm.w * 0.8, dm.h * 0.8,
+                                  SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_HIDDEN);
+        init_window_icon();
+        ren_init(window);
+    }
 
-    window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, dm.w * 0.8, dm.h * 0.8,
-                              SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_HIDDEN);
-    init_window_icon();
-    ren_init(window);
+    if (record_file && !apiRecordEvents(record_file))
+        usage_error("could not open file for recording", record_file);
+    if (replay_file && !apiReplayEvents(replay_file))
+        usage_error("could not open file for replay", replay_file);
 
     WrenConfiguration config;
-    wrenInitConfiguration(&config);
-    config.bindForeignMethodFn = apiBindForeignMethods;
-    config.bindForeignClassFn = apiBindForeignClasses;
-    config.writeFn = writeFn;
-    config.errorFn = errorFn;
-    config.loadModuleFn = loadModuleFn;
+    init_config(&config);
     WrenVM *vm = wrenNewVM(&config);
 
+    main_vm = vm;
+    atexit(write_profiles);
+
+    // LITE_PROFILE=<file> profiles the whole session, see the profiler module
+    profile_path = getenv("LITE_PROFILE");
+    if (profile_path)
+        wrenProfilerStart(vm, 1);
+
+#if WREN_DEBUG_TRACK_ALLOCATIONS
+    // LITE_ALLOC_REPORT=<file> writes the top allocators of every frame
+    const char *alloc_report_path = getenv("LITE_ALLOC_REPORT");
+    if (alloc_report_path)
+    {
+        alloc_report = fopen(alloc_report_path, "w");
+        if (!alloc_report)
+            usage_error("could not open allocation report", alloc_report_path);
+        api_context.on_end_frame = report_frame_allocations;
+    }
+#endif
+
     wrenEnsureSlots(vm, 2);
     wrenSetSlotNewList(vm, 0);
     for (int i = 0; i < argc; i++)
@@ -215,6 +346,7 @@ int main(int argc, char **argv)
 
     );
 
+    write_profiles();
     SDL_DestroyWindow(window);
     wrenReleaseHandle(vm, api_context.args);
     wrenFreeVM(vm);
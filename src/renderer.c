@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <math.h>
@@ -27,6 +28,8 @@ struct RenFont {
 
 
 static SDL_Window *window;
+static RenImage *headless_target;
+static const char *frame_dump_dir;
 static struct { int left, top, right, bottom; } clip;
 
 
@@ -56,15 +59,66 @@ static const char* utf8_to_codepoint(const char *p, unsigned *dst) {
 }
 
 
+static RenImage* get_target(void) {
+  static RenImage target;
+  if (headless_target) { return headless_target; }
+  SDL_Surface *surf = SDL_GetWindowSurface(window);
+  target.pixels = surf->pixels;
+  target.width = surf->w;
+  target.height = surf->h;
+  return &target;
+}
+
+
 void ren_init(SDL_Window *win) {
   assert(win);
   window = win;
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
-  ren_set_clip_rect( (RenRect) { 0, 0, surf->w, surf->h } );
+  RenImage *target = get_target();
+  ren_set_clip_rect( (RenRect) { 0, 0, target->width, target->height } );
+}
+
+
+void ren_init_headless(SDL_Window *win, int width, int height) {
+  assert(win);
+  window = win;
+  headless_target = ren_new_image(width, height);
+  memset(headless_target->pixels, 0, width * height * sizeof(RenColor));
+  ren_set_clip_rect( (RenRect) { 0, 0, width, height } );
+}
+
+
+void ren_dump_frames(const char *dir) {
+  frame_dump_dir = dir;
+}
+
+
+bool ren_save_ppm(const char *filename) {
+  RenImage *target = get_target();
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) { return false; }
+  fprintf(fp, "P6\n%d %d\n255\n", target->width, target->height);
+  RenColor *p = target->pixels;
+  for (int i = target->width * target->height; i > 0; i--, p++) {
+    uint8_t rgb[3] = { p->r, p->g, p->b };
+    fwrite(rgb, 1, 3, fp);
+  }
+  return fclose(fp) == 0;
 }
 
 
 void ren_update_rects(RenRect *rects, int count) {
+  if (headless_target) {
+    static int frame = 0;
+    if (frame_dump_dir) {
+      char filename[1024];
+      snprintf(filename, sizeof(filename), "%s/frame%05d.ppm", frame_dump_dir, frame);
+      if (!ren_save_ppm(filename)) {
+        fprintf(stderr, "Error: could not write frame to '%s'\n", filename);
+      }
+    }
+    frame++;
+    return;
+  }
   SDL_UpdateWindowSurfaceRects(window, (SDL_Rect*) rects, count);
   static bool initial_frame = true;
   if (initial_frame) {
@@ -83,9 +137,9 @@ void ren_set_clip_rect(RenRect rect) {
 
 
 void ren_get_size(int *x, int *y) {
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
-  *x = surf->w;
-  *y = surf->h;
+  RenImage *target = get_target();
+  *x = target->width;
+  *y = target->height;
 }
 
 
@@ -285,10 +339,10 @@ void ren_draw_rect(RenRect rect, RenColor color) {
   x2 = x2 > clip.right  ? clip.right  : x2;
   y2 = y2 > clip.bottom ? clip.bottom : y2;
 
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
-  RenColor *d = (RenColor*) surf->pixels;
-  d += x1 + y1 * surf->w;
-  int dr = surf->w - (x2 - x1);
+  RenImage *target = get_target();
+  RenColor *d = target->pixels;
+  d += x1 + y1 * target->width;
+  int dr = target->width - (x2 - x1);
 
   if (color.a == 0xff) {
     rect_draw_loop(color);
@@ -313,13 +367,13 @@ void ren_draw_image(RenImage *image, RenRect *sub, int x, int y, RenColor color)
   }
 
   /* draw */
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
+  RenImage *target = get_target();
   RenColor *s = image->pixels;
-  RenColor *d = (RenColor*) surf->pixels;
+  RenColor *d = target->pixels;
   s += sub->x + sub->y * image->width;
-  d += x + y * surf->w;
+  d += x + y * target->width;
   int sr = image->width - sub->width;
-  int dr = surf->w - sub->width;
+  int dr = target->width - sub->width;
 
   for (int j = 0; j < sub->height; j++) {
     for (int i = 0; i < sub->width; i++) {
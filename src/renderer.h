@@ -3,6 +3,7 @@
 
 #include <SDL2/SDL.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct RenImage RenImage;
 typedef struct RenFont RenFont;
@@ -12,6 +13,9 @@ typedef struct { int x, y, width, height; } RenRect;
 
 
 void ren_init(SDL_Window *win);
+void ren_init_headless(SDL_Window *win, int width, int height);
+void ren_dump_frames(const char *dir);
+bool ren_save_ppm(const char *filename);
 void ren_update_rects(RenRect *rects, int count);
 void ren_set_clip_rect(RenRect rect);
 void ren_get_size(int *x, int *y);